@@ -1,24 +1,164 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <omp.h>
+#include <sys/mman.h>
 #include "allocator.h"
 
+#ifdef USE_LIBNUMA
+#include <numa.h>
+#endif
+
 static Allocator allocator;
+static int first_touch_enabled = 1;
+static PageMode page_mode = PAGES_DEFAULT;
+
+// Every buffer starts with one cache line recording how it was obtained, so
+// the data that follows stays 64-byte aligned
+typedef struct BufferHeader {
+  size_t mapped_size; // length passed to mmap, 0 when from posix_memalign
+} BufferHeader;
+
+static size_t round_up(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+void allocator_set_page_mode(PageMode mode) { page_mode = mode; }
+
+PageMode allocator_page_mode() { return page_mode; }
+
+const char *allocator_page_mode_name(PageMode mode) {
+  switch (mode) {
+  case PAGES_TRANSPARENT:
+    return "thp";
+  case PAGES_HUGETLB:
+    return "hugetlb";
+  default:
+    return "default";
+  }
+}
+
+// Allocate a cache-line aligned buffer padded to whole cache lines, backed by
+// huge pages according to the current page mode
+void *allocator_alloc_buffer(size_t size) {
+  size_t padded = round_up(size, CACHE_LINE_SIZE) + CACHE_LINE_SIZE;
+  size_t mapped_size = 0;
+  void *block = NULL;
+
+  if (page_mode == PAGES_HUGETLB) {
+    size_t length = round_up(padded, HUGE_PAGE_SIZE);
+    block = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (block == MAP_FAILED) {
+      static int warned = 0;
+      if (!warned) {
+        printf("MAP_HUGETLB failed, falling back to transparent huge pages\n");
+        warned = 1;
+      }
+      block = NULL;
+    } else {
+      mapped_size = length;
+    }
+  }
+
+  if (!block && page_mode != PAGES_DEFAULT) {
+    size_t length = round_up(padded, HUGE_PAGE_SIZE);
+    if (posix_memalign(&block, HUGE_PAGE_SIZE, length) == 0) {
+      madvise(block, length, MADV_HUGEPAGE);
+    } else {
+      block = NULL;
+    }
+  }
+
+  if (!block && posix_memalign(&block, CACHE_LINE_SIZE, padded) != 0) {
+    return NULL;
+  }
+
+  ((BufferHeader *)block)->mapped_size = mapped_size;
+  return (char *)block + CACHE_LINE_SIZE;
+}
+
+void allocator_free_buffer(void *buffer) {
+  if (!buffer)
+    return;
+
+  void *block = (char *)buffer - CACHE_LINE_SIZE;
+  size_t mapped_size = ((BufferHeader *)block)->mapped_size;
+  if (mapped_size > 0) {
+    munmap(block, mapped_size);
+  } else {
+    free(block);
+  }
+}
+
+void allocator_set_first_touch(int enabled) { first_touch_enabled = enabled; }
+
+// Zero a freshly allocated buffer from the threads that will later work on it.
+// Linux places each page on the NUMA node of the thread that first writes it,
+// so the static schedule here must match the one of the loops using the
+// buffer: chunk > 0 for schedule(static, chunk), 0 for plain schedule(static).
+void allocator_first_touch(void *buffer, size_t element_size, int count,
+                           int chunk) {
+  char *bytes = (char *)buffer;
+
+  if (!first_touch_enabled) {
+    memset(buffer, 0, element_size * count);
+    return;
+  }
+
+  if (chunk > 0) {
+#pragma omp parallel for schedule(static, chunk)
+    for (int i = 0; i < count; i++) {
+      memset(bytes + i * element_size, 0, element_size);
+    }
+  } else {
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < count; i++) {
+      memset(bytes + i * element_size, 0, element_size);
+    }
+  }
+}
+
+// Spread the OpenMP threads evenly over the NUMA nodes and make them allocate
+// locally. Returns the number of nodes, or 0 when built without libnuma.
+int allocator_bind_threads() {
+#ifdef USE_LIBNUMA
+  if (numa_available() < 0) {
+    printf("NUMA is not available on this system\n");
+    return -1;
+  }
+
+  int nodes = numa_num_configured_nodes();
+#pragma omp parallel
+  {
+    int node = omp_get_thread_num() * nodes / omp_get_num_threads();
+    numa_run_on_node(node);
+    numa_set_localalloc();
+  }
+  return nodes;
+#else
+  return 0;
+#endif
+}
 
 int allocator_init(int capacity) {
   allocator.capacity = capacity;
   allocator.allocated_count = 0;
   allocator.next_free = 0;
   
-  allocator.pool = (Circle *)malloc(capacity * sizeof(Circle));
+  allocator.pool = (Circle *)allocator_alloc_buffer(capacity * sizeof(Circle));
   if (!allocator.pool) {
     printf("Failed to allocate memory pool\n");
     return -1;
   }
+  allocator_first_touch(allocator.pool, sizeof(Circle), capacity,
+                        PARTICLE_CHUNK);
   
-  allocator.free_list = (int *)malloc(capacity * sizeof(int));
+  allocator.free_list = (int *)allocator_alloc_buffer(capacity * sizeof(int));
   if (!allocator.free_list) {
     printf("Failed to allocate free list\n");
-    free(allocator.pool);
+    allocator_free_buffer(allocator.pool);
+    allocator.pool = NULL;
     return -1;
   }
   
@@ -57,6 +197,12 @@ Circle *allocator_get_pool() {
   return allocator.pool;
 }
 
+int allocator_free_slots() {
+  return allocator.capacity - allocator.allocated_count;
+}
+
+int allocator_capacity() { return allocator.capacity; }
+
 void allocator_reset() {
   allocator.allocated_count = 0;
   allocator.next_free = 0;
@@ -68,16 +214,129 @@ void allocator_reset() {
 
 void allocator_cleanup() {
   if (allocator.pool) {
-    free(allocator.pool);
+    allocator_free_buffer(allocator.pool);
     allocator.pool = NULL;
   }
   
   if (allocator.free_list) {
-    free(allocator.free_list);
+    allocator_free_buffer(allocator.free_list);
     allocator.free_list = NULL;
   }
   
   allocator.capacity = 0;
   allocator.allocated_count = 0;
   allocator.next_free = 0;
-}
\ No newline at end of file
+}
+
+// One sub-arena per OpenMP thread, each on its own cache line
+static union {
+  FrameArena arena;
+  char pad[CACHE_LINE_SIZE];
+} frame_arenas[FRAME_ARENA_MAX_THREADS];
+static int frame_arena_count;
+
+#ifdef DEBUG
+static long frame_heap_allocations;
+#endif
+
+static void *frame_heap_alloc(size_t size) {
+#ifdef DEBUG
+#pragma omp atomic
+  frame_heap_allocations++;
+#endif
+  return allocator_alloc_buffer(size);
+}
+
+// Allocate size bytes, cache-line aligned, from the calling thread's
+// sub-arena. The memory is valid until the next frame_arena_reset().
+void *frame_alloc(size_t size) {
+  int thread = omp_get_thread_num();
+  if (thread >= FRAME_ARENA_MAX_THREADS) {
+    printf("Frame arena supports at most %d threads\n",
+           FRAME_ARENA_MAX_THREADS);
+    return NULL;
+  }
+
+  FrameArena *arena = &frame_arenas[thread].arena;
+  size = round_up(size, CACHE_LINE_SIZE);
+  arena->requested += size;
+
+  // Created lazily so that its pages are first touched by the owning thread
+  if (!arena->base) {
+    size_t capacity = round_up(size, FRAME_ARENA_INITIAL_SIZE);
+    arena->base = frame_heap_alloc(capacity);
+    if (!arena->base)
+      return NULL;
+    arena->capacity = capacity;
+#pragma omp critical(frame_arena_count)
+    if (thread >= frame_arena_count)
+      frame_arena_count = thread + 1;
+  }
+
+  if (arena->used + size <= arena->capacity) {
+    void *memory = arena->base + arena->used;
+    arena->used += size;
+    return memory;
+  }
+
+  // Does not fit: chain a heap block that lives until the next reset
+  char *block = frame_heap_alloc(size + CACHE_LINE_SIZE);
+  if (!block)
+    return NULL;
+  *(void **)block = arena->overflow;
+  arena->overflow = block;
+  return block + CACHE_LINE_SIZE;
+}
+
+// Release everything allocated this frame. Sub-arenas that overflowed are
+// regrown to hold their high-water mark.
+void frame_arena_reset() {
+  for (int t = 0; t < frame_arena_count; t++) {
+    FrameArena *arena = &frame_arenas[t].arena;
+
+    while (arena->overflow) {
+      void *next = *(void **)arena->overflow;
+      allocator_free_buffer(arena->overflow);
+      arena->overflow = next;
+    }
+
+    if (arena->requested > arena->high_water)
+      arena->high_water = arena->requested;
+
+    if (arena->high_water > arena->capacity) {
+      allocator_free_buffer(arena->base);
+      arena->capacity = round_up(arena->high_water, FRAME_ARENA_INITIAL_SIZE);
+      arena->base = frame_heap_alloc(arena->capacity);
+      if (!arena->base)
+        arena->capacity = 0;
+    }
+
+    arena->used = 0;
+    arena->requested = 0;
+  }
+}
+
+void frame_arena_stats(FrameArenaStats *stats) {
+  *stats = (FrameArenaStats){0};
+  for (int t = 0; t < frame_arena_count; t++) {
+    FrameArena *arena = &frame_arenas[t].arena;
+    stats->capacity += arena->capacity;
+    stats->requested += arena->requested;
+    stats->high_water += arena->high_water;
+  }
+#ifdef DEBUG
+  stats->heap_allocations = frame_heap_allocations;
+#else
+  stats->heap_allocations = -1;
+#endif
+}
+
+void frame_arena_cleanup() {
+  frame_arena_reset();
+  for (int t = 0; t < frame_arena_count; t++) {
+    FrameArena *arena = &frame_arenas[t].arena;
+    allocator_free_buffer(arena->base);
+    *arena = (FrameArena){0};
+  }
+  frame_arena_count = 0;
+}
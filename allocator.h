@@ -1,8 +1,19 @@
 #ifndef ALLOCATOR_H
 #define ALLOCATOR_H
 
+#include <stddef.h>
+
 #include "defs.h"
 
+#define CACHE_LINE_SIZE 64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef enum PageMode {
+  PAGES_DEFAULT,     // regular pages
+  PAGES_TRANSPARENT, // huge-page aligned and advised with MADV_HUGEPAGE
+  PAGES_HUGETLB      // explicit MAP_HUGETLB, falls back to transparent
+} PageMode;
+
 typedef struct Allocator {
   Circle *pool;
   int *free_list;
@@ -11,11 +22,51 @@ typedef struct Allocator {
   int allocated_count;
 } Allocator;
 
+// Per-frame bump allocator for transient buffers, with one sub-arena per
+// OpenMP thread. Everything allocated from it is released by
+// frame_arena_reset() at the top of each step. A request that does not fit is
+// served from the heap and the sub-arena grows to its high-water mark at the
+// next reset, so steady-state frames make no heap allocations.
+#define FRAME_ARENA_MAX_THREADS 256
+#define FRAME_ARENA_INITIAL_SIZE (256 * 1024)
+
+typedef struct FrameArena {
+  char *base;
+  size_t capacity;
+  size_t used;       // bytes handed out from base this frame
+  size_t requested;  // bytes requested this frame, including overflow
+  size_t high_water; // largest request total of any frame
+  void *overflow;    // heap blocks for requests that did not fit
+} FrameArena;
+
+typedef struct FrameArenaStats {
+  size_t capacity;       // bytes reserved over all sub-arenas
+  size_t requested;      // bytes requested since the last reset
+  size_t high_water;     // sum of the sub-arena high-water marks
+  long heap_allocations; // heap allocations made so far, -1 unless DEBUG
+} FrameArenaStats;
+
 int allocator_init(int capacity);
 int allocator_alloc_particle();
 void allocator_free_particle(int index);
 void allocator_reset();
 void allocator_cleanup();
 Circle *allocator_get_pool();
+int allocator_free_slots();
+int allocator_capacity();
+void allocator_set_page_mode(PageMode mode);
+PageMode allocator_page_mode();
+const char *allocator_page_mode_name(PageMode mode);
+void *allocator_alloc_buffer(size_t size);
+void allocator_free_buffer(void *buffer);
+void allocator_set_first_touch(int enabled);
+void allocator_first_touch(void *buffer, size_t element_size, int count,
+                           int chunk);
+int allocator_bind_threads();
+
+void *frame_alloc(size_t size);
+void frame_arena_reset();
+void frame_arena_stats(FrameArenaStats *stats);
+void frame_arena_cleanup();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,119 @@
+#include <math.h>
+#include <omp.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+#include "balance.h"
+#include "defs.h"
+#include "physics.h"
+
+extern State state;
+
+typedef struct TileTask {
+  int tile;
+  int cost;
+} TileTask;
+
+static int compare_cost_descending(const void *a, const void *b) {
+  return ((const TileTask *)b)->cost - ((const TileTask *)a)->cost;
+}
+
+static void set_thread_busy(double seconds) {
+  int thread = omp_get_thread_num();
+  if (thread < MAX_TIMED_THREADS)
+    state.timings.thread_busy_ms[thread] = seconds * 1000.0;
+#pragma omp single nowait
+  state.timings.threads = omp_get_num_threads() < MAX_TIMED_THREADS
+                              ? omp_get_num_threads()
+                              : MAX_TIMED_THREADS;
+}
+
+static float handle_tile_collisions(int tile, int tiles_x) {
+  int x0 = (tile % tiles_x) * COLLISION_TILE_SIZE;
+  int y0 = (tile / tiles_x) * COLLISION_TILE_SIZE;
+  int x1 = x0 + COLLISION_TILE_SIZE;
+  int y1 = y0 + COLLISION_TILE_SIZE;
+  if (x1 > state.grid_width)
+    x1 = state.grid_width;
+  if (y1 > state.grid_height)
+    y1 = state.grid_height;
+
+  float deepest = 0.0f;
+  for (int y = y0; y < y1; y++) {
+    for (int x = x0; x < x1; x++) {
+      deepest = fmaxf(deepest, handle_grid_cell_collisions(x, y));
+    }
+  }
+  return deepest;
+}
+
+// Equal blocks of cells per thread, matching the grid's first-touch placement
+float handle_grid_collisions_static() {
+  float deepest = 0.0f;
+#pragma omp parallel reduction(max : deepest)
+  {
+    double start = omp_get_wtime();
+#pragma omp for collapse(2) schedule(static) nowait
+    for (int y = 0; y < state.grid_height; y++) {
+      for (int x = 0; x < state.grid_width; x++) {
+        deepest = fmaxf(deepest, handle_grid_cell_collisions(x, y));
+      }
+    }
+    set_thread_busy(omp_get_wtime() - start);
+  }
+  return deepest;
+}
+
+// Under gravity most particles sit in a few rows, so equal blocks of cells
+// leave most threads idle. Estimate each tile's cost from the grid counts
+// (pair tests grow with count squared), skip empty tiles and hand the rest
+// out dynamically, largest first, so the big tiles do not end up last.
+float handle_grid_collisions_balanced() {
+  int tiles_x =
+      (state.grid_width + COLLISION_TILE_SIZE - 1) / COLLISION_TILE_SIZE;
+  int tiles_y =
+      (state.grid_height + COLLISION_TILE_SIZE - 1) / COLLISION_TILE_SIZE;
+  int num_tiles = tiles_x * tiles_y;
+
+  TileTask *tasks = frame_alloc(num_tiles * sizeof(TileTask));
+  if (!tasks) {
+    return handle_grid_collisions_static();
+  }
+
+#pragma omp parallel for schedule(static)
+  for (int t = 0; t < num_tiles; t++) {
+    int x0 = (t % tiles_x) * COLLISION_TILE_SIZE;
+    int y0 = (t / tiles_x) * COLLISION_TILE_SIZE;
+    int cost = 0;
+    for (int y = y0; y < y0 + COLLISION_TILE_SIZE && y < state.grid_height;
+         y++) {
+      for (int x = x0; x < x0 + COLLISION_TILE_SIZE && x < state.grid_width;
+           x++) {
+        int count = state.grid[y * state.grid_width + x].count;
+        cost += count * count;
+      }
+    }
+    tasks[t] = (TileTask){.tile = t, .cost = cost};
+  }
+
+  int num_tasks = 0;
+  for (int t = 0; t < num_tiles; t++) {
+    if (tasks[t].cost > 0)
+      tasks[num_tasks++] = tasks[t];
+  }
+  qsort(tasks, num_tasks, sizeof(TileTask), compare_cost_descending);
+
+  float deepest = 0.0f;
+#pragma omp parallel reduction(max : deepest)
+  {
+    double busy = 0.0;
+#pragma omp for schedule(dynamic, 1) nowait
+    for (int k = 0; k < num_tasks; k++) {
+      double start = omp_get_wtime();
+      deepest = fmaxf(deepest, handle_tile_collisions(tasks[k].tile, tiles_x));
+      busy += omp_get_wtime() - start;
+    }
+    set_thread_busy(busy);
+  }
+  return deepest;
+}
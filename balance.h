@@ -0,0 +1,7 @@
+#ifndef BALANCE_H
+#define BALANCE_H
+
+float handle_grid_collisions_static();
+float handle_grid_collisions_balanced();
+
+#endif
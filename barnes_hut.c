@@ -0,0 +1,421 @@
+#include <math.h>
+#include <omp.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "barnes_hut.h"
+#include "defs.h"
+
+extern State state;
+
+// 16 bits per axis, two bits (one quadrant) per tree level
+#define MORTON_LEVELS 16
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+// Subtrees with more particles than this are built as separate OpenMP tasks
+#define BARNES_HUT_TASK_SIZE 2048
+// Each level pushes at most four children
+#define BARNES_HUT_STACK (4 * MORTON_LEVELS + 4)
+
+typedef struct MortonKey {
+  uint32_t code;
+  int index;
+} MortonKey;
+
+typedef struct BarnesHutNode {
+  float x; // centre of the absolute source strengths
+  float y;
+  float strength; // total mass, or total charge
+  float weight;   // total absolute strength
+  float min_x;    // the node's square
+  float min_y;
+  float size;
+  int begin; // range of Morton-sorted particles
+  int end;
+  int leaf;
+  int child[4]; // -1 for empty quadrants
+} BarnesHutNode;
+
+// The tree and structure-of-arrays copies of the particles in Morton order
+typedef struct BarnesHutTree {
+  BarnesHutNode *nodes;
+  int node_count;
+  uint32_t *codes;
+  int *order; // particle index of each sorted slot
+  float *x;
+  float *y;
+  float *strength;
+} BarnesHutTree;
+
+const char *long_range_force_name(LongRangeForce force) {
+  switch (force) {
+  case LONG_RANGE_GRAVITY:
+    return "gravity";
+  case LONG_RANGE_ELECTROSTATIC:
+    return "electrostatic";
+  default:
+    return "none";
+  }
+}
+
+// What a particle contributes to the field, and how the field accelerates it
+static float source_strength(const Circle *p, LongRangeForce force) {
+  return force == LONG_RANGE_GRAVITY ? p->m : p->charge;
+}
+
+static float coupling(const Circle *p, LongRangeForce force) {
+  if (force == LONG_RANGE_GRAVITY)
+    return GRAVITATIONAL_CONSTANT;
+  return -COULOMB_CONSTANT * p->charge / p->m;
+}
+
+// Softened inverse-square field of a source at offset (dx, dy)
+static void add_field(float strength, float dx, float dy, float *ex,
+                      float *ey) {
+  float r_sq = dx * dx + dy * dy + BARNES_HUT_SOFTENING * BARNES_HUT_SOFTENING;
+  float scale = strength / (r_sq * sqrtf(r_sq));
+  *ex += dx * scale;
+  *ey += dy * scale;
+}
+
+static uint32_t spread_bits(uint32_t v) {
+  v &= 0xffff;
+  v = (v | (v << 8)) & 0x00ff00ff;
+  v = (v | (v << 4)) & 0x0f0f0f0f;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+static int quadrant(uint32_t code, int level) {
+  return (code >> (2 * (MORTON_LEVELS - 1 - level))) & 3;
+}
+
+// Stable LSD radix sort by code. Every thread histograms its block of keys,
+// and one prefix sum in digit-major, thread-minor order gives each thread its
+// scatter offsets, so the result does not depend on the thread count.
+static void sort_keys(MortonKey *keys, MortonKey *scratch, int count,
+                      int *histograms) {
+  MortonKey *from = keys;
+  MortonKey *to = scratch;
+  for (int shift = 0; shift < 32; shift += RADIX_BITS) {
+#pragma omp parallel
+    {
+      int threads = omp_get_num_threads();
+      int t = omp_get_thread_num();
+      int begin = (int)((long)count * t / threads);
+      int end = (int)((long)count * (t + 1) / threads);
+      int *histogram = &histograms[t * RADIX_SIZE];
+      memset(histogram, 0, RADIX_SIZE * sizeof(int));
+      for (int i = begin; i < end; i++) {
+        histogram[(from[i].code >> shift) & (RADIX_SIZE - 1)]++;
+      }
+
+#pragma omp barrier
+#pragma omp single
+      {
+        int offset = 0;
+        for (int digit = 0; digit < RADIX_SIZE; digit++) {
+          for (int u = 0; u < threads; u++) {
+            int *slot = &histograms[u * RADIX_SIZE + digit];
+            int digit_count = *slot;
+            *slot = offset;
+            offset += digit_count;
+          }
+        }
+      }
+
+      for (int i = begin; i < end; i++) {
+        to[histogram[(from[i].code >> shift) & (RADIX_SIZE - 1)]++] = from[i];
+      }
+    }
+    MortonKey *swap = from;
+    from = to;
+    to = swap;
+  }
+}
+
+static void set_moments(BarnesHutNode *n, float strength, float weight,
+                        float x, float y) {
+  n->strength = strength;
+  n->weight = weight;
+  n->x = weight > 0.0f ? x / weight : n->min_x + 0.5f * n->size;
+  n->y = weight > 0.0f ? y / weight : n->min_y + 0.5f * n->size;
+}
+
+// First slot in [begin, end) whose quadrant at this level is at least q
+static int quadrant_start(const uint32_t *codes, int begin, int end,
+                          int level, int q) {
+  while (begin < end) {
+    int mid = begin + (end - begin) / 2;
+    if (quadrant(codes[mid], level) < q) {
+      begin = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+  return begin;
+}
+
+// Build the node over sorted slots [begin, end) of the square at (min_x,
+// min_y). Node slots are claimed atomically, but children are always combined
+// in quadrant order, so the moments do not depend on the task schedule.
+static void build_node(BarnesHutTree *t, int node, int begin, int end,
+                       int level, float min_x, float min_y, float size) {
+  // Quadrants that hold the whole range would make single-child nodes, so
+  // the node shrinks into them instead
+  while (end - begin > BARNES_HUT_LEAF_SIZE && level < MORTON_LEVELS) {
+    int q = quadrant(t->codes[begin], level);
+    if (q != quadrant(t->codes[end - 1], level))
+      break;
+    size *= 0.5f;
+    min_x += (q >> 1) * size;
+    min_y += (q & 1) * size;
+    level++;
+  }
+
+  BarnesHutNode *n = &t->nodes[node];
+  *n = (BarnesHutNode){.min_x = min_x,
+                       .min_y = min_y,
+                       .size = size,
+                       .begin = begin,
+                       .end = end,
+                       .child = {-1, -1, -1, -1}};
+
+  if (end - begin <= BARNES_HUT_LEAF_SIZE || level == MORTON_LEVELS) {
+    float strength = 0.0f, weight = 0.0f, x = 0.0f, y = 0.0f;
+    for (int i = begin; i < end; i++) {
+      float w = fabsf(t->strength[i]);
+      strength += t->strength[i];
+      weight += w;
+      x += w * t->x[i];
+      y += w * t->y[i];
+    }
+    n->leaf = 1;
+    set_moments(n, strength, weight, x, y);
+    return;
+  }
+
+  int bounds[5] = {begin, 0, 0, 0, end};
+  int children = 0;
+  for (int q = 1; q < 4; q++) {
+    bounds[q] = quadrant_start(t->codes, bounds[q - 1], end, level, q);
+  }
+  for (int q = 0; q < 4; q++) {
+    children += bounds[q + 1] > bounds[q];
+  }
+
+  int first_child;
+#pragma omp atomic capture
+  {
+    first_child = t->node_count;
+    t->node_count += children;
+  }
+
+  float half = 0.5f * size;
+  for (int q = 0, c = 0; q < 4; q++) {
+    if (bounds[q + 1] == bounds[q])
+      continue;
+    int child = first_child + c++;
+    int child_begin = bounds[q];
+    int child_end = bounds[q + 1];
+    float child_x = min_x + (q >> 1) * half;
+    float child_y = min_y + (q & 1) * half;
+    n->child[q] = child;
+    if (child_end - child_begin > BARNES_HUT_TASK_SIZE) {
+#pragma omp task firstprivate(child, child_begin, child_end, child_x, child_y)
+      build_node(t, child, child_begin, child_end, level + 1, child_x,
+                 child_y, half);
+    } else {
+      build_node(t, child, child_begin, child_end, level + 1, child_x,
+                 child_y, half);
+    }
+  }
+#pragma omp taskwait
+
+  float strength = 0.0f, weight = 0.0f, x = 0.0f, y = 0.0f;
+  for (int q = 0; q < 4; q++) {
+    if (n->child[q] < 0)
+      continue;
+    const BarnesHutNode *c = &t->nodes[n->child[q]];
+    strength += c->strength;
+    weight += c->weight;
+    x += c->weight * c->x;
+    y += c->weight * c->y;
+  }
+  set_moments(n, strength, weight, x, y);
+}
+
+// Sort the particles along a Morton curve over their bounding square and
+// build the tree top down from the sorted order
+static int build_tree(BarnesHutTree *t, LongRangeForce force) {
+  int count = state.particle_count;
+  MortonKey *keys = frame_alloc(count * sizeof(MortonKey));
+  MortonKey *scratch = frame_alloc(count * sizeof(MortonKey));
+  int *histograms =
+      frame_alloc(omp_get_max_threads() * RADIX_SIZE * sizeof(int));
+  t->nodes = frame_alloc((2 * count + 1) * sizeof(BarnesHutNode));
+  t->codes = frame_alloc(count * sizeof(uint32_t));
+  t->order = frame_alloc(count * sizeof(int));
+  t->x = frame_alloc(count * sizeof(float));
+  t->y = frame_alloc(count * sizeof(float));
+  t->strength = frame_alloc(count * sizeof(float));
+  if (!keys || !scratch || !histograms || !t->nodes || !t->codes ||
+      !t->order || !t->x || !t->y || !t->strength)
+    return -1;
+
+  float min_x = INFINITY, min_y = INFINITY;
+  float max_x = -INFINITY, max_y = -INFINITY;
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)                     \
+    reduction(min : min_x, min_y) reduction(max : max_x, max_y)
+  for (int i = 0; i < count; i++) {
+    Circle *p = &state.particles[i];
+    min_x = fminf(min_x, p->xcenter);
+    min_y = fminf(min_y, p->ycenter);
+    max_x = fmaxf(max_x, p->xcenter);
+    max_y = fmaxf(max_y, p->ycenter);
+  }
+  float size = fmaxf(fmaxf(max_x - min_x, max_y - min_y), 1.0f);
+  float scale = (1 << MORTON_LEVELS) / size;
+
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+  for (int i = 0; i < count; i++) {
+    Circle *p = &state.particles[i];
+    uint32_t cell_x = (uint32_t)((p->xcenter - min_x) * scale);
+    uint32_t cell_y = (uint32_t)((p->ycenter - min_y) * scale);
+    uint32_t top = (1 << MORTON_LEVELS) - 1;
+    cell_x = cell_x > top ? top : cell_x;
+    cell_y = cell_y > top ? top : cell_y;
+    keys[i] = (MortonKey){(spread_bits(cell_x) << 1) | spread_bits(cell_y), i};
+  }
+
+  sort_keys(keys, scratch, count, histograms);
+
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+  for (int i = 0; i < count; i++) {
+    Circle *p = &state.particles[keys[i].index];
+    t->codes[i] = keys[i].code;
+    t->order[i] = keys[i].index;
+    t->x[i] = p->xcenter;
+    t->y[i] = p->ycenter;
+    t->strength[i] = source_strength(p, force);
+  }
+
+  t->node_count = 1;
+#pragma omp parallel
+#pragma omp single
+  build_node(t, 0, 0, count, 0, min_x, min_y, size);
+  return 0;
+}
+
+// Field at sorted slot i. Nodes far enough away by theta count as one source
+// at their centre. The node holding the particle is always opened, and its
+// own leaf skips it.
+static void tree_field(const BarnesHutTree *t, int i, float theta_sq,
+                       float *ex, float *ey) {
+  float px = t->x[i];
+  float py = t->y[i];
+  int stack[BARNES_HUT_STACK];
+  int top = 0;
+  stack[top++] = 0;
+  *ex = 0.0f;
+  *ey = 0.0f;
+
+  while (top > 0) {
+    const BarnesHutNode *n = &t->nodes[stack[--top]];
+    if (n->weight == 0.0f)
+      continue;
+
+    float dx = n->x - px;
+    float dy = n->y - py;
+    int inside = i >= n->begin && i < n->end;
+    if (!inside && n->size * n->size < theta_sq * (dx * dx + dy * dy)) {
+      add_field(n->strength, dx, dy, ex, ey);
+    } else if (n->leaf) {
+      for (int j = n->begin; j < n->end; j++) {
+        if (j != i)
+          add_field(t->strength[j], t->x[j] - px, t->y[j] - py, ex, ey);
+      }
+    } else {
+      // Pushed in reverse so quadrants are visited in order
+      for (int q = 3; q >= 0; q--) {
+        if (n->child[q] >= 0)
+          stack[top++] = n->child[q];
+      }
+    }
+  }
+}
+
+int compute_long_range_accelerations(LongRangeForce force, float theta,
+                                     float *ax, float *ay,
+                                     BarnesHutStats *stats) {
+  int count = state.particle_count;
+  if (count == 0)
+    return 0;
+
+  double build_start = omp_get_wtime();
+  BarnesHutTree t;
+  if (build_tree(&t, force) < 0)
+    return -1;
+  double eval_start = omp_get_wtime();
+
+  // Walk in Morton order, so neighbouring iterations open the same nodes
+  float theta_sq = theta * theta;
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+  for (int i = 0; i < count; i++) {
+    float ex, ey;
+    tree_field(&t, i, theta_sq, &ex, &ey);
+    int index = t.order[i];
+    float k = coupling(&state.particles[index], force);
+    ax[index] = k * ex;
+    ay[index] = k * ey;
+  }
+
+  if (stats) {
+    stats->build_ms = (eval_start - build_start) * 1000.0;
+    stats->eval_ms = (omp_get_wtime() - eval_start) * 1000.0;
+    stats->nodes = t.node_count;
+  }
+  return 0;
+}
+
+void compute_long_range_brute(LongRangeForce force, float *ax, float *ay) {
+  int count = state.particle_count;
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+  for (int i = 0; i < count; i++) {
+    Circle *p = &state.particles[i];
+    float ex = 0.0f, ey = 0.0f;
+    for (int j = 0; j < count; j++) {
+      if (j == i)
+        continue;
+      Circle *q = &state.particles[j];
+      add_field(source_strength(q, force), q->xcenter - p->xcenter,
+                q->ycenter - p->ycenter, &ex, &ey);
+    }
+    float k = coupling(p, force);
+    ax[i] = k * ex;
+    ay[i] = k * ey;
+  }
+}
+
+void apply_long_range_forces() {
+  LongRangeForce force = state.settings.long_range;
+  int count = state.particle_count;
+  float dt = state.step_dt;
+  if (force == LONG_RANGE_NONE || count == 0)
+    return;
+
+  float *ax = frame_alloc(count * sizeof(float));
+  float *ay = frame_alloc(count * sizeof(float));
+  if (!ax || !ay ||
+      compute_long_range_accelerations(force, state.settings.theta, ax, ay,
+                                       NULL) < 0)
+    return;
+
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+  for (int i = 0; i < count; i++) {
+    state.particles[i].xvelocity += ax[i] * dt;
+    state.particles[i].yvelocity += ay[i] * dt;
+  }
+}
@@ -0,0 +1,27 @@
+#ifndef BARNES_HUT_H
+#define BARNES_HUT_H
+
+#include "defs.h"
+
+// Where the time of the last tree evaluation went
+typedef struct BarnesHutStats {
+  double build_ms; // bounds, Morton codes, sort and tree
+  double eval_ms;  // tree walks of all particles
+  int nodes;
+} BarnesHutStats;
+
+const char *long_range_force_name(LongRangeForce force);
+
+// Long-range acceleration of every particle, indexed like state.particles.
+// The tree version opens nodes by theta, the brute-force version sums over all
+// pairs and is the reference for accuracy checks. Scratch comes from the frame
+// arena. Return -1 if it runs out.
+int compute_long_range_accelerations(LongRangeForce force, float theta,
+                                     float *ax, float *ay,
+                                     BarnesHutStats *stats);
+void compute_long_range_brute(LongRangeForce force, float *ax, float *ay);
+
+// Apply the configured long-range force to the particle velocities
+void apply_long_range_forces();
+
+#endif
@@ -0,0 +1,640 @@
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+#include "barnes_hut.h"
+#include "constraints.h"
+#include "bench.h"
+#include "defs.h"
+#include "neighbour.h"
+#include "query.h"
+#include "scenario.h"
+#include "state.h"
+#include "util.h"
+
+extern State state;
+
+#define BENCH_WARMUP_FRAMES 5
+#define QUERY_CHECK_MAX_K 16
+
+// Jittered lattice scenes, from a fast sparse spray to a packed pile
+typedef struct BenchScene {
+  const char *name;
+  float spacing; // lattice spacing in pixels
+  float speed;   // maximum initial speed in pixels/s
+  float fill;    // fraction of the world height covered, from the bottom
+} BenchScene;
+
+static const BenchScene default_scene = {"lattice", 3.0f * PARTICLE_RADIUS,
+                                         20.0f, 1.0f};
+static const BenchScene density_scenes[] = {
+    {"sparse", 8.0f * PARTICLE_RADIUS, 200.0f, 1.0f},
+    {"medium", 4.0f * PARTICLE_RADIUS, 40.0f, 1.0f},
+    {"packed", 2.1f * PARTICLE_RADIUS, 5.0f, 1.0f},
+};
+// Everything settled in the bottom rows, the worst case for static schedules
+static const BenchScene pile_scene = {"pile", 2.1f * PARTICLE_RADIUS, 5.0f,
+                                      0.125f};
+
+// A block of fluid at rest spacing, collapsing under its own pressure
+static const BenchScene fluid_scene = {"fluid", SPH_SPACING, 0.0f, 0.5f};
+
+static FrameArenaStats last_arena_stats;
+static long steady_heap_allocations = -1;
+
+static int lattice_columns(int particles) {
+  return (int)ceilf(sqrtf((float)particles));
+}
+
+static int world_side(int particles, const BenchScene *scene) {
+  return (int)(lattice_columns(particles) * scene->spacing) + 2 * BORDER_WIDTH +
+         GRID_CELL_SIZE;
+}
+
+static int world_height(int particles, const BenchScene *scene) {
+  return (int)(world_side(particles, scene) / scene->fill);
+}
+
+// Fill a square world with a jittered lattice of particles, built in parallel
+// with the same chunking as the physics loops. The jitter never lets two
+// neighbours overlap.
+static int setup_scene(int particles, const BenchScene *scene) {
+  int columns = lattice_columns(particles);
+  int side = world_side(particles, scene);
+  int height = world_height(particles, scene);
+  float top = height - side; // lattice sits at the bottom of the world
+  float jitter = scene->spacing - 2.0f * PARTICLE_RADIUS;
+
+  if (allocator_init(particles) < 0 || init_world(side, height) < 0) {
+    return -1;
+  }
+  reset_state();
+  init_state();
+  state.source.is_active = 0;
+
+  int first = add_particles(particles);
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+  for (int i = 0; i < particles; i++) {
+    uint32_t h = hash_index(i);
+    float offset_x = (h & 0xff) / 255.0f - 0.5f;
+    float offset_y = ((h >> 8) & 0xff) / 255.0f - 0.5f;
+    state.particles[first + i] = (Circle){
+        .xcenter = BORDER_WIDTH + (i % columns + 1) * scene->spacing +
+                   offset_x * jitter,
+        .ycenter = top + BORDER_WIDTH + (i / columns + 1) * scene->spacing +
+                   offset_y * jitter,
+        .radius = PARTICLE_RADIUS,
+        .xvelocity = offset_x * scene->speed,
+        .yvelocity = offset_y * scene->speed,
+        .m = PARTICLE_MASS,
+        .cor = PARTICLE_COR,
+        .charge = (h >> 15) & 1 ? 1.0f : -1.0f,
+        .color = {h >> 16, h >> 24, 200},
+        .id = first + i};
+  }
+
+  return 0;
+}
+
+static void teardown_scene() {
+  reset_state();
+  cleanup_world();
+  allocator_cleanup();
+}
+
+// Average per-phase timings over the given number of frames
+static int measure(int particles, int frames, const BenchScene *scene,
+                   PhaseTimings *average) {
+  if (setup_scene(particles, scene) < 0) {
+    return -1;
+  }
+
+  for (int f = 0; f < BENCH_WARMUP_FRAMES; f++) {
+    update_state();
+  }
+
+  FrameArenaStats before;
+  frame_arena_stats(&before);
+
+  *average = (PhaseTimings){0};
+  for (int f = 0; f < frames; f++) {
+    update_state();
+    average->integrate_ms += state.timings.integrate_ms / frames;
+    average->grid_ms += state.timings.grid_ms / frames;
+    average->collide_ms += state.timings.collide_ms / frames;
+    average->threads = state.timings.threads;
+    for (int t = 0; t < state.timings.threads; t++) {
+      average->thread_busy_ms[t] += state.timings.thread_busy_ms[t] / frames;
+    }
+  }
+
+  // Steady-state frames must not touch the heap
+  frame_arena_stats(&last_arena_stats);
+  if (before.heap_allocations >= 0) {
+    steady_heap_allocations =
+        last_arena_stats.heap_allocations - before.heap_allocations;
+  }
+
+  teardown_scene();
+  return 0;
+}
+
+int run_benchmark(int particles, int frames) {
+  int max_threads = omp_get_max_threads();
+  double baseline[2] = {0.0, 0.0};
+
+  // Timings must not depend on the wall clock
+  float saved_dt = state.settings.fixed_dt;
+  state.settings.fixed_dt = DETERMINISTIC_DT;
+  PageMode saved_pages = allocator_page_mode();
+
+  int side = world_side(particles, &default_scene);
+  printf("Benchmark: %d particles in a %dx%d px world, %d frames, up to %d "
+         "threads\n",
+         particles, side, side, frames, max_threads);
+  printf("Broad phase: %s\n", broad_phase_name(state.settings.broad_phase));
+  printf("%7s %11s %10s %10s %10s %10s %8s\n", "threads", "first-touch",
+         "integrate", "grid", "collide", "total", "speedup");
+
+  for (int threads = 1;; threads *= 2) {
+    if (threads > max_threads)
+      threads = max_threads;
+
+    for (int first_touch = 0; first_touch <= 1; first_touch++) {
+      PhaseTimings t;
+      omp_set_num_threads(threads);
+      allocator_bind_threads();
+      allocator_set_first_touch(first_touch);
+
+      if (measure(particles, frames, &default_scene, &t) < 0) {
+        printf("Failed to set up a scene with %d particles\n", particles);
+        return -1;
+      }
+
+      double total = t.integrate_ms + t.grid_ms + t.collide_ms;
+      if (threads == 1)
+        baseline[first_touch] = total;
+      printf("%7d %11s %10.3f %10.3f %10.3f %10.3f %7.2fx\n", threads,
+             first_touch ? "on" : "off", t.integrate_ms, t.grid_ms,
+             t.collide_ms, total, baseline[first_touch] / total);
+    }
+
+    if (threads == max_threads)
+      break;
+  }
+
+  // Page size comparison at full thread count with first touch on
+  printf("\n%7s %11s %10s %10s %10s %10s %8s\n", "threads", "pages",
+         "integrate", "grid", "collide", "total", "speedup");
+  allocator_set_first_touch(1);
+  omp_set_num_threads(max_threads);
+  double default_total = 0.0;
+  for (PageMode mode = PAGES_DEFAULT; mode <= PAGES_HUGETLB; mode++) {
+    PhaseTimings t;
+    allocator_set_page_mode(mode);
+    if (measure(particles, frames, &default_scene, &t) < 0) {
+      printf("Failed to set up a scene with %d particles\n", particles);
+      return -1;
+    }
+
+    double total = t.integrate_ms + t.grid_ms + t.collide_ms;
+    if (mode == PAGES_DEFAULT)
+      default_total = total;
+    printf("%7d %11s %10.3f %10.3f %10.3f %10.3f %7.2fx\n", max_threads,
+           allocator_page_mode_name(mode), t.integrate_ms, t.grid_ms,
+           t.collide_ms, total, default_total / total);
+  }
+
+  allocator_set_page_mode(saved_pages);
+
+  if (state.settings.broad_phase == BROAD_PHASE_NEIGHBOUR_LIST) {
+    long rebuilds, steps;
+    neighbour_list_stats(&rebuilds, &steps);
+    printf("\nNeighbour lists rebuilt on %ld of %ld steps\n", rebuilds, steps);
+  }
+
+  printf("\nFrame arena: %zu KB reserved, %zu KB high water",
+         last_arena_stats.capacity / 1024, last_arena_stats.high_water / 1024);
+  if (steady_heap_allocations >= 0) {
+    printf(", %ld heap allocations in measured frames\n",
+           steady_heap_allocations);
+  } else {
+    printf(" (build with DEBUG=1 to count heap allocations)\n");
+  }
+  state.settings.fixed_dt = saved_dt;
+  return 0;
+}
+
+// Compare the broad phases on scenes of increasing density at the full
+// thread count
+int run_broad_phase_benchmark(int particles, int frames) {
+  BroadPhase saved_broad_phase = state.settings.broad_phase;
+  float saved_dt = state.settings.fixed_dt;
+  state.settings.fixed_dt = DETERMINISTIC_DT;
+
+  printf("Broad phase benchmark: %d particles, %d frames, %d threads\n",
+         particles, frames, omp_get_max_threads());
+  printf("%7s %7s %10s %10s %10s %10s\n", "scene", "broad", "integrate",
+         "build", "collide", "total");
+
+  int num_scenes = sizeof(density_scenes) / sizeof(density_scenes[0]);
+  for (int s = 0; s < num_scenes; s++) {
+    for (int b = 0; b < BROAD_PHASE_COUNT; b++) {
+      PhaseTimings t;
+      state.settings.broad_phase = b;
+      if (measure(particles, frames, &density_scenes[s], &t) < 0) {
+        printf("Failed to set up a scene with %d particles\n", particles);
+        return -1;
+      }
+      printf("%7s %7s %10.3f %10.3f %10.3f %10.3f\n", density_scenes[s].name,
+             broad_phase_name(b), t.integrate_ms, t.grid_ms, t.collide_ms,
+             t.integrate_ms + t.grid_ms + t.collide_ms);
+    }
+  }
+
+  state.settings.broad_phase = saved_broad_phase;
+  state.settings.fixed_dt = saved_dt;
+  return 0;
+}
+
+// Compare static and cost-weighted collision scheduling on a settled pile
+int run_balance_benchmark(int particles, int frames) {
+  CollisionSchedule saved_schedule = state.settings.collision_schedule;
+  BroadPhase saved_broad_phase = state.settings.broad_phase;
+  float saved_dt = state.settings.fixed_dt;
+  state.settings.fixed_dt = DETERMINISTIC_DT;
+  state.settings.broad_phase = BROAD_PHASE_GRID;
+
+  printf("Load balance benchmark: %d particles in a %dx%d px pile, %d frames, "
+         "%d threads\n",
+         particles, world_side(particles, &pile_scene),
+         world_height(particles, &pile_scene), frames, omp_get_max_threads());
+  printf("%8s %10s %10s %10s %10s %10s\n", "schedule", "collide", "busy min",
+         "busy mean", "busy max", "imbalance");
+
+  CollisionSchedule schedules[] = {SCHEDULE_STATIC, SCHEDULE_COST};
+  for (int s = 0; s < 2; s++) {
+    PhaseTimings t = {0};
+    state.settings.collision_schedule = schedules[s];
+    if (measure(particles, frames, &pile_scene, &t) < 0) {
+      printf("Failed to set up a scene with %d particles\n", particles);
+      return -1;
+    }
+
+    double busy_min = t.thread_busy_ms[0];
+    double busy_max = 0.0;
+    double busy_total = 0.0;
+    for (int i = 0; i < t.threads; i++) {
+      if (t.thread_busy_ms[i] < busy_min)
+        busy_min = t.thread_busy_ms[i];
+      if (t.thread_busy_ms[i] > busy_max)
+        busy_max = t.thread_busy_ms[i];
+      busy_total += t.thread_busy_ms[i];
+    }
+    double busy_mean = t.threads > 0 ? busy_total / t.threads : 0.0;
+    printf("%8s %10.3f %10.3f %10.3f %10.3f %9.2fx\n",
+           schedules[s] == SCHEDULE_STATIC ? "static" : "cost", t.collide_ms,
+           busy_min, busy_mean, busy_max,
+           busy_mean > 0.0 ? busy_max / busy_mean : 1.0);
+  }
+
+  state.settings.collision_schedule = saved_schedule;
+  state.settings.broad_phase = saved_broad_phase;
+  state.settings.fixed_dt = saved_dt;
+  return 0;
+}
+
+// Throughput of the SPH solver on a fluid block, from one thread up to all
+int run_sph_benchmark(int particles, int frames) {
+  PhysicsModel saved_model = state.settings.model;
+  float saved_dt = state.settings.fixed_dt;
+  int max_threads = omp_get_max_threads();
+  state.settings.fixed_dt = DETERMINISTIC_DT;
+  state.settings.model = MODEL_SPH;
+
+  printf("SPH benchmark: %d particles in a %dx%d px world, %d frames\n",
+         particles, world_side(particles, &fluid_scene),
+         world_height(particles, &fluid_scene), frames);
+  printf("%7s %10s %10s %10s %10s %14s\n", "threads", "integrate", "grid",
+         "fluid", "total", "particles/s");
+
+  for (int threads = 1;; threads *= 2) {
+    if (threads > max_threads)
+      threads = max_threads;
+
+    PhaseTimings t;
+    omp_set_num_threads(threads);
+    if (measure(particles, frames, &fluid_scene, &t) < 0) {
+      printf("Failed to set up a scene with %d particles\n", particles);
+      return -1;
+    }
+
+    double total = t.integrate_ms + t.grid_ms + t.collide_ms;
+    printf("%7d %10.3f %10.3f %10.3f %10.3f %14.0f\n", threads,
+           t.integrate_ms, t.grid_ms, t.collide_ms, total,
+           total > 0.0 ? particles / (total / 1000.0) : 0.0);
+
+    if (threads == max_threads)
+      break;
+  }
+
+  state.settings.model = saved_model;
+  state.settings.fixed_dt = saved_dt;
+  return 0;
+}
+
+// Average tree timings of one angle over the given number of evaluations,
+// leaving the last accelerations in ax and ay
+static int measure_barnes_hut(LongRangeForce force, float theta, int frames,
+                              float *ax, float *ay, BarnesHutStats *average) {
+  *average = (BarnesHutStats){0};
+  for (int f = 0; f < frames; f++) {
+    BarnesHutStats stats;
+    frame_arena_reset();
+    if (compute_long_range_accelerations(force, theta, ax, ay, &stats) < 0) {
+      return -1;
+    }
+    average->build_ms += stats.build_ms / frames;
+    average->eval_ms += stats.eval_ms / frames;
+    average->nodes = stats.nodes;
+  }
+  return 0;
+}
+
+// Barnes-Hut against the brute-force sum on a sparse lattice: relative RMS
+// error of the accelerations and time per evaluation at several angles
+int run_barnes_hut_benchmark(int particles, int frames) {
+  static const float thetas[] = {0.25f, 0.5f, 0.75f, 1.0f};
+  static const LongRangeForce forces[] = {LONG_RANGE_GRAVITY,
+                                          LONG_RANGE_ELECTROSTATIC};
+  const BenchScene *scene = &density_scenes[0];
+
+  if (setup_scene(particles, scene) < 0) {
+    printf("Failed to set up a scene with %d particles\n", particles);
+    return -1;
+  }
+  float *reference_x = malloc(particles * sizeof(float));
+  float *reference_y = malloc(particles * sizeof(float));
+  float *ax = malloc(particles * sizeof(float));
+  float *ay = malloc(particles * sizeof(float));
+  if (!reference_x || !reference_y || !ax || !ay) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+
+  printf("Barnes-Hut benchmark: %d particles in a %dx%d px world, %d threads, "
+         "%d evaluations per angle\n",
+         particles, world_side(particles, scene),
+         world_height(particles, scene), omp_get_max_threads(), frames);
+
+  int result = 0;
+  for (size_t f = 0; f < sizeof(forces) / sizeof(forces[0]) && result == 0;
+       f++) {
+    double brute_start = omp_get_wtime();
+    compute_long_range_brute(forces[f], reference_x, reference_y);
+    double brute_ms = (omp_get_wtime() - brute_start) * 1000.0;
+
+    printf("%s, brute force %.3f ms\n", long_range_force_name(forces[f]),
+           brute_ms);
+    printf("%7s %10s %10s %10s %10s %12s\n", "theta", "build", "walk",
+           "nodes", "speedup", "rms error");
+
+    for (size_t t = 0; t < sizeof(thetas) / sizeof(thetas[0]); t++) {
+      BarnesHutStats average;
+      if (measure_barnes_hut(forces[f], thetas[t], frames, ax, ay, &average) <
+          0) {
+        printf("Frame arena allocation failed\n");
+        result = -1;
+        break;
+      }
+
+      double error_sq = 0.0, reference_sq = 0.0;
+      for (int i = 0; i < particles; i++) {
+        double dx = ax[i] - reference_x[i];
+        double dy = ay[i] - reference_y[i];
+        error_sq += dx * dx + dy * dy;
+        reference_sq += (double)reference_x[i] * reference_x[i] +
+                        (double)reference_y[i] * reference_y[i];
+      }
+      double total = average.build_ms + average.eval_ms;
+      printf("%7.2f %10.3f %10.3f %10d %9.1fx %12.2e\n", thetas[t],
+             average.build_ms, average.eval_ms, average.nodes,
+             total > 0.0 ? brute_ms / total : 0.0,
+             reference_sq > 0.0 ? sqrt(error_sq / reference_sq) : 0.0);
+    }
+  }
+
+  free(reference_x);
+  free(reference_y);
+  free(ax);
+  free(ay);
+  teardown_scene();
+  return result;
+}
+
+// Constraint solver time for many soft bodies resting side by side on the
+// floor, from one thread up to all of them
+int run_constraint_benchmark(int bodies, int frames) {
+  float saved_dt = state.settings.fixed_dt;
+  int max_threads = omp_get_max_threads();
+  int per_row = lattice_columns(bodies);
+  float body_size = SOFT_BODY_SIZE * SOFT_BODY_SPACING + 2.0f * PARTICLE_RADIUS;
+  int side = (int)(per_row * body_size) + 2 * BORDER_WIDTH + GRID_CELL_SIZE;
+  int particles = bodies * SOFT_BODY_SIZE * SOFT_BODY_SIZE;
+  state.settings.fixed_dt = DETERMINISTIC_DT;
+
+  printf("Constraint benchmark: %d soft bodies of %dx%d particles in a %dx%d "
+         "px world, %d frames\n",
+         bodies, SOFT_BODY_SIZE, SOFT_BODY_SIZE, side, side, frames);
+  printf("%7s %12s %10s %10s %16s\n", "threads", "constraints", "collide",
+         "solve", "constraints/s");
+
+  for (int threads = 1;; threads *= 2) {
+    if (threads > max_threads)
+      threads = max_threads;
+    omp_set_num_threads(threads);
+
+    if (allocator_init(particles) < 0 || init_world(side, side) < 0) {
+      printf("Failed to set up %d soft bodies\n", bodies);
+      return -1;
+    }
+    reset_state();
+    init_state();
+    state.source.is_active = 0;
+    float corner = BORDER_WIDTH + PARTICLE_RADIUS;
+    for (int b = 0; b < bodies; b++) {
+      spawn_soft_body(corner + (b % per_row) * body_size,
+                      corner + (b / per_row) * body_size, SOFT_BODY_SIZE);
+    }
+
+    for (int f = 0; f < BENCH_WARMUP_FRAMES; f++) {
+      update_state();
+    }
+    double collide_ms = 0.0;
+    double solve_ms = 0.0;
+    for (int f = 0; f < frames; f++) {
+      update_state();
+      collide_ms += state.timings.collide_ms / frames;
+      solve_ms += state.timings.constraint_ms / frames;
+    }
+
+    printf("%7d %12d %10.3f %10.3f %16.0f\n", threads, constraint_count(),
+           collide_ms, solve_ms,
+           solve_ms > 0.0 ? constraint_count() / (solve_ms / 1000.0) : 0.0);
+    teardown_scene();
+
+    if (threads == max_threads)
+      break;
+  }
+
+  state.settings.fixed_dt = saved_dt;
+  return 0;
+}
+
+// Run the loaded scenario the way the GUI does, emitter included, at every
+// thread count. Deterministic scenarios must end on the same hash.
+int run_scenario_benchmark(int frames) {
+  int max_threads = omp_get_max_threads();
+  int width, height, capacity;
+
+  scenario_dimensions(&width, &height, &capacity);
+  printf("Scenario benchmark: %s, %d frames\n", scenario_name(), frames);
+  printf("%7s %10s %10s %10s %10s %10s %10s  %s\n", "threads", "particles",
+         "load", "integrate", "grid", "collide", "total", "final hash");
+
+  for (int threads = 1;; threads *= 2) {
+    if (threads > max_threads)
+      threads = max_threads;
+    omp_set_num_threads(threads);
+
+    if (init_scenario_world(capacity) < 0) {
+      printf("Failed to set up scenario %s\n", scenario_name());
+      return -1;
+    }
+    double load_start = omp_get_wtime();
+    reset_state();
+    init_state();
+    double load_ms = (omp_get_wtime() - load_start) * 1000.0;
+
+    PhaseTimings average = {0};
+    for (int f = 0; f < frames; f++) {
+      update_particle_source();
+      update_state();
+      average.integrate_ms += state.timings.integrate_ms / frames;
+      average.grid_ms += state.timings.grid_ms / frames;
+      average.collide_ms += state.timings.collide_ms / frames;
+    }
+
+    printf("%7d %10d %10.3f %10.3f %10.3f %10.3f %10.3f  ", threads,
+           state.particle_count, load_ms, average.integrate_ms,
+           average.grid_ms, average.collide_ms,
+           average.integrate_ms + average.grid_ms + average.collide_ms);
+    if (state.settings.deterministic) {
+      printf("%016llx\n", (unsigned long long)state.state_hash);
+    } else {
+      printf("-\n");
+    }
+    teardown_scene();
+
+    if (threads == max_threads)
+      break;
+  }
+  return 0;
+}
+
+// Uniform in [0, 1) from the bits of a hashed counter
+static float hashed_unit(uint32_t counter) {
+  return (hash_index(counter) & 0xffffff) / (float)0x1000000;
+}
+
+// Radius, rectangle and k-nearest queries on a stepped scene, where particles
+// have moved since they were binned, against scans of every particle. Query
+// points reach half a world past each edge. Returns -1 on any mismatch.
+int run_query_check(int particles, int queries) {
+  const BenchScene *scene = &density_scenes[1];
+  if (setup_scene(particles, scene) < 0) {
+    printf("Failed to set up a scene with %d particles\n", particles);
+    return -1;
+  }
+  for (int f = 0; f < BENCH_WARMUP_FRAMES; f++) {
+    update_state();
+  }
+
+  int *out = malloc(particles * sizeof(int));
+  char *listed = calloc(particles, 1);
+  float nearest_sq[QUERY_CHECK_MAX_K];
+  if (!out || !listed) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+
+  printf("Query check: %d particles in a %dx%d px world, %d queries each\n",
+         particles, state.world_width, state.world_height, queries);
+
+  int radius_failures = 0, rect_failures = 0, nearest_failures = 0;
+  for (int q = 0; q < queries; q++) {
+    uint32_t counter = (uint32_t)q * 8;
+    float x = (hashed_unit(counter) * 2.0f - 0.5f) * state.world_width;
+    float y = (hashed_unit(counter + 1) * 2.0f - 0.5f) * state.world_height;
+    float size = (1.0f + hashed_unit(counter + 2) * 8.0f) * GRID_CELL_SIZE;
+    float width = hashed_unit(counter + 3) * 2.0f * size;
+    int k = 1 + hash_index(counter + 4) % QUERY_CHECK_MAX_K;
+
+    // Radius and rectangle: every listed index is marked, then each particle
+    // must be marked exactly when the scan finds it inside
+    for (int rect = 0; rect <= 1; rect++) {
+      int count = rect ? query_rect_bulk(x, y, x + width, y + size, out,
+                                         particles)
+                       : query_radius_bulk(x, y, size, out, particles);
+      for (int j = 0; j < count; j++) {
+        listed[out[j]]++;
+      }
+      int wrong = 0;
+      for (int i = 0; i < state.particle_count; i++) {
+        Circle *p = &state.particles[i];
+        float dx = p->xcenter - x;
+        float dy = p->ycenter - y;
+        int inside = rect ? p->xcenter >= x && p->xcenter <= x + width &&
+                                p->ycenter >= y && p->ycenter <= y + size
+                          : dx * dx + dy * dy <= size * size;
+        wrong |= listed[i] != inside;
+        listed[i] = 0;
+      }
+      if (wrong && rect)
+        rect_failures++;
+      else if (wrong)
+        radius_failures++;
+    }
+
+    // Nearest: the result is sorted, has min(k, n) entries and nothing
+    // outside it is strictly closer than the last one
+    int found = query_nearest_bulk(x, y, k, out, nearest_sq);
+    int expected = k < state.particle_count ? k : state.particle_count;
+    int wrong = found != expected;
+    for (int j = 1; j < found; j++) {
+      wrong |= nearest_sq[j] < nearest_sq[j - 1];
+    }
+    if (!wrong && found > 0) {
+      int closer = 0;
+      for (int i = 0; i < state.particle_count; i++) {
+        float dx = state.particles[i].xcenter - x;
+        float dy = state.particles[i].ycenter - y;
+        closer += dx * dx + dy * dy < nearest_sq[found - 1];
+      }
+      wrong = closer >= found;
+    }
+    nearest_failures += wrong;
+  }
+
+  printf("%8s %10s\n", "query", "failures");
+  printf("%8s %10d\n", "radius", radius_failures);
+  printf("%8s %10d\n", "rect", rect_failures);
+  printf("%8s %10d\n", "nearest", nearest_failures);
+
+  free(out);
+  free(listed);
+  teardown_scene();
+  return radius_failures + rect_failures + nearest_failures > 0 ? -1 : 0;
+}
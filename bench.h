@@ -0,0 +1,14 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+int run_benchmark(int particles, int frames);
+int run_broad_phase_benchmark(int particles, int frames);
+int run_balance_benchmark(int particles, int frames);
+
+int run_sph_benchmark(int particles, int frames);
+int run_barnes_hut_benchmark(int particles, int frames);
+int run_constraint_benchmark(int bodies, int frames);
+int run_scenario_benchmark(int frames);
+int run_query_check(int particles, int queries);
+
+#endif
@@ -0,0 +1,98 @@
+#include <math.h>
+
+#include "allocator.h"
+#include "brush.h"
+#include "defs.h"
+#include "query.h"
+
+extern State state;
+
+// Cursor at the previous step, for the drag velocity
+static float step_x;
+static float step_y;
+static float cursor_velocity_x;
+static float cursor_velocity_y;
+
+const char *brush_tool_name(BrushTool tool) {
+  switch (tool) {
+  case BRUSH_REPEL:
+    return "repel";
+  case BRUSH_DRAG:
+    return "drag";
+  default:
+    return "attract";
+  }
+}
+
+void brush_press(int x, int y) {
+  state.brush.active = 1;
+  state.brush.x = x;
+  state.brush.y = y;
+  if (state.brush.radius <= 0.0f)
+    state.brush.radius = BRUSH_RADIUS;
+
+  step_x = x;
+  step_y = y;
+}
+
+void brush_move(int x, int y) {
+  state.brush.x = x;
+  state.brush.y = y;
+}
+
+void brush_release() { state.brush.active = 0; }
+
+// Find the particles under the brush through the grid, before the step moves
+// them. Returns their number; the indices live in the frame arena. Also
+// updates the cursor velocity and returns the step length in dt, the same
+// state.step_dt the integration uses.
+int collect_brushed_particles(int **indices, float *dt) {
+  if (!state.brush.active || state.particle_count == 0)
+    return 0;
+
+  *dt = state.step_dt;
+  if (*dt > 0.0f) {
+    cursor_velocity_x = (state.brush.x - step_x) / *dt;
+    cursor_velocity_y = (state.brush.y - step_y) / *dt;
+  }
+  step_x = state.brush.x;
+  step_y = state.brush.y;
+
+  *indices = frame_alloc(state.particle_count * sizeof(int));
+  if (!*indices)
+    return 0;
+  return query_radius_bulk(state.brush.x, state.brush.y, state.brush.radius,
+                           *indices, state.particle_count);
+}
+
+// Change one brushed particle's velocity. Forces fall off linearly to zero at
+// the edge of the brush. Safe to call in parallel for distinct particles.
+void apply_brush(Circle *particle, float dt) {
+  float dx = state.brush.x - particle->xcenter;
+  float dy = state.brush.y - particle->ycenter;
+  float dist = sqrtf(dx * dx + dy * dy);
+  float falloff = 1.0f - dist / state.brush.radius;
+  if (falloff <= 0.0f)
+    return;
+
+  switch (state.brush.tool) {
+  case BRUSH_DRAG: {
+    float blend = fminf(BRUSH_DRAG_RATE * falloff * dt, 1.0f);
+    particle->xvelocity += (cursor_velocity_x - particle->xvelocity) * blend;
+    particle->yvelocity += (cursor_velocity_y - particle->yvelocity) * blend;
+    break;
+  }
+  case BRUSH_ATTRACT:
+  case BRUSH_REPEL: {
+    if (dist <= 0.0f)
+      return;
+    float sign = state.brush.tool == BRUSH_ATTRACT ? 1.0f : -1.0f;
+    float impulse = sign * BRUSH_ACCELERATION * falloff * dt / dist;
+    particle->xvelocity += dx * impulse;
+    particle->yvelocity += dy * impulse;
+    break;
+  }
+  default:
+    break;
+  }
+}
@@ -0,0 +1,13 @@
+#ifndef BRUSH_H
+#define BRUSH_H
+
+#include "defs.h"
+
+void brush_press(int x, int y);
+void brush_move(int x, int y);
+void brush_release();
+int collect_brushed_particles(int **indices, float *dt);
+void apply_brush(Circle *particle, float dt);
+const char *brush_tool_name(BrushTool tool);
+
+#endif
@@ -0,0 +1,391 @@
+#include <SDL2/SDL.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "defs.h"
+
+extern State state;
+
+// Largest stored deflate block
+#define DEFLATE_BLOCK 65535
+
+typedef struct CaptureBuffer {
+  unsigned char *pixels; // RGB24 rows, pitch bytes apart
+  long index;            // frame number
+} CaptureBuffer;
+
+// Buffers cycle from the free stack to the queue, through an encoder and
+// back to the free stack. All of it is guarded by lock.
+static struct {
+  int active;
+  CaptureFormat format;
+  int wait_when_full;
+  char dir[1024];
+  int width; // of the encoded frames
+  int height;
+  int pitch; // of the read-back buffers, which span the whole renderer
+  int yuv_fd; // the single output file of CAPTURE_YUV
+  CaptureBuffer buffers[CAPTURE_QUEUE_DEPTH];
+  CaptureBuffer *free_buffers[CAPTURE_QUEUE_DEPTH];
+  int free_count;
+  CaptureBuffer *queue[CAPTURE_QUEUE_DEPTH];
+  int queue_head;
+  int queue_count;
+  int stopping;
+  pthread_mutex_t lock;
+  pthread_cond_t queued;
+  pthread_cond_t freed;
+  pthread_t encoders[CAPTURE_ENCODER_THREADS];
+  int encoder_count;
+  long next_index;
+  long written;
+  long dropped;
+  long failed;
+} capture;
+
+static uint32_t crc_table[256];
+
+const char *capture_format_name(CaptureFormat format) {
+  return format == CAPTURE_YUV ? "yuv" : "png";
+}
+
+static void init_crc_table() {
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    }
+    crc_table[n] = c;
+  }
+}
+
+static uint32_t update_crc(uint32_t crc, const unsigned char *data,
+                           size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+static void put_be32(unsigned char *out, uint32_t value) {
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+static int write_chunk(FILE *file, const char *type,
+                       const unsigned char *data, uint32_t length) {
+  unsigned char head[8];
+  unsigned char tail[4];
+  put_be32(head, length);
+  memcpy(head + 4, type, 4);
+  uint32_t crc = update_crc(0xffffffffu, head + 4, 4);
+  crc = update_crc(crc, data, length);
+  put_be32(tail, crc ^ 0xffffffffu);
+  return fwrite(head, 1, 8, file) == 8 &&
+                 fwrite(data, 1, length, file) == length &&
+                 fwrite(tail, 1, 4, file) == 4
+             ? 0
+             : -1;
+}
+
+// Bytes of the zlib stream holding raw in stored blocks
+static size_t zlib_stored_size(size_t raw) {
+  size_t blocks = raw / DEFLATE_BLOCK + 1;
+  return 2 + blocks * 5 + raw + 4;
+}
+
+// The frame as a PNG with a stored (uncompressed) deflate stream: encoding
+// costs a copy and two checksums, the disk does the rest. scratch holds
+// zlib_stored_size() of the filtered image.
+static int encode_png(const CaptureBuffer *buffer, unsigned char *scratch,
+                      const char *path) {
+  int width = capture.width;
+  int height = capture.height;
+  size_t row = (size_t)width * 3;
+  size_t raw = (row + 1) * height;
+  size_t pitch = capture.pitch;
+
+  // Filter type 0 before every row, then the zlib stream around it
+  unsigned char *out = scratch;
+  *out++ = 0x78;
+  *out++ = 0x01;
+  uint32_t a = 1, b = 0;
+  size_t remaining = raw;
+  size_t block_left = 0;
+  int y = 0;
+  size_t x = 0; // byte within the current filtered row, 0 = filter byte
+  while (remaining > 0) {
+    if (block_left == 0) {
+      block_left = remaining < DEFLATE_BLOCK ? remaining : DEFLATE_BLOCK;
+      *out++ = block_left == remaining;
+      *out++ = block_left & 0xff;
+      *out++ = block_left >> 8;
+      *out++ = ~block_left & 0xff;
+      *out++ = (~block_left >> 8) & 0xff;
+    }
+    size_t count = x == 0 ? 1 : row + 1 - x;
+    if (count > block_left)
+      count = block_left;
+    const unsigned char *source =
+        x == 0 ? (const unsigned char *)"\0"
+               : &buffer->pixels[y * pitch + (x - 1)];
+    memcpy(out, source, count);
+    for (size_t i = 0; i < count; i++) {
+      a = (a + out[i]) % 65521;
+      b = (b + a) % 65521;
+    }
+    out += count;
+    block_left -= count;
+    remaining -= count;
+    x += count;
+    if (x == row + 1) {
+      x = 0;
+      y++;
+    }
+  }
+  put_be32(out, (b << 16) | a);
+  out += 4;
+
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return -1;
+  unsigned char ihdr[13];
+  put_be32(ihdr, width);
+  put_be32(ihdr + 4, height);
+  ihdr[8] = 8;  // bit depth
+  ihdr[9] = 2;  // RGB
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filtering
+  ihdr[12] = 0; // no interlace
+  int result =
+      fwrite("\x89PNG\r\n\x1a\n", 1, 8, file) == 8 &&
+              write_chunk(file, "IHDR", ihdr, sizeof(ihdr)) == 0 &&
+              write_chunk(file, "IDAT", scratch, out - scratch) == 0 &&
+              write_chunk(file, "IEND", NULL, 0) == 0
+          ? 0
+          : -1;
+  if (fclose(file) != 0)
+    result = -1;
+  return result;
+}
+
+// BT.601 limited range I420, chroma averaged over 2x2 blocks. The frame goes
+// to its own offset in the stream, so encoders can finish out of order.
+static int encode_yuv(const CaptureBuffer *buffer, unsigned char *scratch) {
+  int width = capture.width;
+  int height = capture.height;
+  int chroma_width = width / 2;
+  size_t luma = (size_t)width * height;
+  unsigned char *plane_u = scratch + luma;
+  unsigned char *plane_v = plane_u + luma / 4;
+
+  for (int y = 0; y < height; y++) {
+    const unsigned char *rgb = &buffer->pixels[(size_t)y * capture.pitch];
+    for (int x = 0; x < width; x++) {
+      int r = rgb[3 * x], g = rgb[3 * x + 1], b = rgb[3 * x + 2];
+      scratch[(size_t)y * width + x] =
+          ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    }
+  }
+  for (int y = 0; y < height / 2; y++) {
+    const unsigned char *top = &buffer->pixels[(size_t)2 * y * capture.pitch];
+    const unsigned char *bottom = top + capture.pitch;
+    for (int x = 0; x < chroma_width; x++) {
+      int r = 0, g = 0, b = 0;
+      for (int k = 0; k < 2; k++) {
+        r += top[6 * x + 3 * k] + bottom[6 * x + 3 * k];
+        g += top[6 * x + 3 * k + 1] + bottom[6 * x + 3 * k + 1];
+        b += top[6 * x + 3 * k + 2] + bottom[6 * x + 3 * k + 2];
+      }
+      r /= 4;
+      g /= 4;
+      b /= 4;
+      plane_u[y * chroma_width + x] =
+          ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+      plane_v[y * chroma_width + x] =
+          ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+  }
+
+  size_t frame_bytes = luma * 3 / 2;
+  off_t offset = (off_t)buffer->index * frame_bytes;
+  return pwrite(capture.yuv_fd, scratch, frame_bytes, offset) ==
+                 (ssize_t)frame_bytes
+             ? 0
+             : -1;
+}
+
+static void *encoder_main(void *arg) {
+  (void)arg;
+  size_t raw = ((size_t)capture.width * 3 + 1) * capture.height;
+  unsigned char *scratch = malloc(zlib_stored_size(raw));
+
+  pthread_mutex_lock(&capture.lock);
+  for (;;) {
+    while (capture.queue_count == 0 && !capture.stopping)
+      pthread_cond_wait(&capture.queued, &capture.lock);
+    if (capture.queue_count == 0)
+      break;
+    CaptureBuffer *buffer = capture.queue[capture.queue_head];
+    capture.queue_head = (capture.queue_head + 1) % CAPTURE_QUEUE_DEPTH;
+    capture.queue_count--;
+    pthread_mutex_unlock(&capture.lock);
+
+    int result = -1;
+    if (scratch && capture.format == CAPTURE_YUV) {
+      result = encode_yuv(buffer, scratch);
+    } else if (scratch) {
+      char path[1100];
+      snprintf(path, sizeof(path), "%s/frame_%06ld.png", capture.dir,
+               buffer->index);
+      result = encode_png(buffer, scratch, path);
+    }
+
+    pthread_mutex_lock(&capture.lock);
+    if (result < 0)
+      capture.failed++;
+    else
+      capture.written++;
+    capture.free_buffers[capture.free_count++] = buffer;
+    pthread_cond_signal(&capture.freed);
+  }
+  pthread_mutex_unlock(&capture.lock);
+
+  free(scratch);
+  return NULL;
+}
+
+int start_capture(const char *dir, CaptureFormat format, int wait_when_full) {
+  int width, height;
+  if (SDL_GetRendererOutputSize(state.renderer, &width, &height) < 0) {
+    printf("Failed to query the renderer size: %s\n", SDL_GetError());
+    return -1;
+  }
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+    printf("Failed to create capture directory %s\n", dir);
+    return -1;
+  }
+
+  memset(&capture, 0, sizeof(capture));
+  capture.format = format;
+  capture.wait_when_full = wait_when_full;
+  snprintf(capture.dir, sizeof(capture.dir), "%s", dir);
+  // I420 subsamples 2x2 blocks
+  capture.width = format == CAPTURE_YUV ? width & ~1 : width;
+  capture.height = format == CAPTURE_YUV ? height & ~1 : height;
+  capture.pitch = width * 3;
+  capture.yuv_fd = -1;
+  init_crc_table();
+
+  if (format == CAPTURE_YUV) {
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/capture.yuv", dir);
+    capture.yuv_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (capture.yuv_fd < 0) {
+      printf("Failed to create %s\n", path);
+      return -1;
+    }
+  }
+
+  size_t frame_bytes = (size_t)capture.pitch * height;
+  for (int i = 0; i < CAPTURE_QUEUE_DEPTH; i++) {
+    capture.buffers[i].pixels = malloc(frame_bytes);
+    if (!capture.buffers[i].pixels) {
+      printf("Failed to allocate capture buffers\n");
+      for (int k = 0; k < i; k++)
+        free(capture.buffers[k].pixels);
+      if (capture.yuv_fd >= 0)
+        close(capture.yuv_fd);
+      return -1;
+    }
+    capture.free_buffers[capture.free_count++] = &capture.buffers[i];
+  }
+
+  pthread_mutex_init(&capture.lock, NULL);
+  pthread_cond_init(&capture.queued, NULL);
+  pthread_cond_init(&capture.freed, NULL);
+  for (int t = 0; t < CAPTURE_ENCODER_THREADS; t++) {
+    if (pthread_create(&capture.encoders[t], NULL, encoder_main, NULL) != 0)
+      break;
+    capture.encoder_count++;
+  }
+  capture.active = 1;
+  if (capture.encoder_count == 0) {
+    printf("Failed to start capture encoders\n");
+    stop_capture();
+    return -1;
+  }
+
+  printf("Capturing %dx%d %s frames to %s\n", capture.width, capture.height,
+         capture_format_name(format), dir);
+  return 0;
+}
+
+void capture_frame() {
+  if (!capture.active)
+    return;
+
+  pthread_mutex_lock(&capture.lock);
+  if (capture.free_count == 0 && !capture.wait_when_full) {
+    capture.dropped++;
+    pthread_mutex_unlock(&capture.lock);
+    return;
+  }
+  while (capture.free_count == 0)
+    pthread_cond_wait(&capture.freed, &capture.lock);
+  CaptureBuffer *buffer = capture.free_buffers[--capture.free_count];
+  pthread_mutex_unlock(&capture.lock);
+
+  // The read-back is the only part of a frame's capture on this thread
+  if (SDL_RenderReadPixels(state.renderer, NULL, SDL_PIXELFORMAT_RGB24,
+                           buffer->pixels, capture.pitch) < 0) {
+    pthread_mutex_lock(&capture.lock);
+    capture.failed++;
+    capture.free_buffers[capture.free_count++] = buffer;
+    pthread_mutex_unlock(&capture.lock);
+    return;
+  }
+
+  pthread_mutex_lock(&capture.lock);
+  buffer->index = capture.next_index++;
+  int tail = (capture.queue_head + capture.queue_count) % CAPTURE_QUEUE_DEPTH;
+  capture.queue[tail] = buffer;
+  capture.queue_count++;
+  pthread_cond_signal(&capture.queued);
+  pthread_mutex_unlock(&capture.lock);
+}
+
+void stop_capture() {
+  if (!capture.active)
+    return;
+
+  pthread_mutex_lock(&capture.lock);
+  capture.stopping = 1;
+  pthread_cond_broadcast(&capture.queued);
+  pthread_mutex_unlock(&capture.lock);
+  for (int t = 0; t < capture.encoder_count; t++) {
+    pthread_join(capture.encoders[t], NULL);
+  }
+
+  for (int i = 0; i < CAPTURE_QUEUE_DEPTH; i++) {
+    free(capture.buffers[i].pixels);
+  }
+  if (capture.yuv_fd >= 0)
+    close(capture.yuv_fd);
+  pthread_mutex_destroy(&capture.lock);
+  pthread_cond_destroy(&capture.queued);
+  pthread_cond_destroy(&capture.freed);
+  capture.active = 0;
+
+  printf("Captured %ld frames (%ld dropped, %ld failed)\n", capture.written,
+         capture.dropped, capture.failed);
+}
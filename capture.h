@@ -0,0 +1,24 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+typedef enum CaptureFormat {
+  CAPTURE_PNG, // one uncompressed PNG per frame
+  CAPTURE_YUV, // all frames in one raw I420 stream
+  CAPTURE_FORMAT_COUNT
+} CaptureFormat;
+
+const char *capture_format_name(CaptureFormat format);
+
+// Start writing rendered frames to dir. Frames are read back on the render
+// thread and encoded by a pool of encoder threads. When all queue buffers
+// are in flight, a frame is dropped, or waited for when wait_when_full is set
+// (offline runs that must not lose frames).
+int start_capture(const char *dir, CaptureFormat format, int wait_when_full);
+
+// Queue the frame in the renderer, called by render() before presenting
+void capture_frame();
+
+// Drain the queue, stop the encoders and report the frame counts
+void stop_capture();
+
+#endif
@@ -0,0 +1,171 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "ccd.h"
+#include "defs.h"
+#include "physics.h"
+#include "state.h"
+
+extern State state;
+
+// How far past first touch a swept particle is placed, in pixels, so that the
+// regular pair kernel sees the contact
+#define CCD_CONTACT_SLOP 0.01f
+
+int is_fast_step(const Circle *particle, float start_x, float start_y) {
+  float step_x = particle->xcenter - start_x;
+  float step_y = particle->ycenter - start_y;
+  float limit = CCD_FAST_FRACTION * particle->radius;
+  return step_x * step_x + step_y * step_y > limit * limit;
+}
+
+// The part of the step that went past a wall comes back reflected and scaled
+// by the restitution, instead of being clamped onto the wall
+static float reflect_axis(float end, float low, float high, float *velocity,
+                          float cor) {
+  if (end < low) {
+    *velocity *= -cor;
+    return low + (low - end) * cor;
+  }
+  if (end > high) {
+    *velocity *= -cor;
+    return high - (end - high) * cor;
+  }
+  return end;
+}
+
+void handle_swept_border_collisions(Circle *particle) {
+  float r = particle->radius;
+  float old_x = particle->xcenter;
+  float old_y = particle->ycenter;
+
+  particle->xcenter = reflect_axis(particle->xcenter, BORDER_WIDTH + r,
+                                   state.world_width - BORDER_WIDTH - r,
+                                   &particle->xvelocity, particle->cor);
+  particle->ycenter = reflect_axis(particle->ycenter, BORDER_WIDTH + r,
+                                   state.world_height - BORDER_WIDTH - r,
+                                   &particle->yvelocity, particle->cor);
+
+  particle->dx += particle->xcenter - old_x;
+  particle->dy += particle->ycenter - old_y;
+
+  // A step long enough to bounce past the opposite wall is still clamped
+  handle_border_collisions(particle);
+}
+
+// Fraction of the step (offset + t * motion) at which a circle first touches
+// a static circle reach away, or -1 if it does not within the step. Pairs
+// that already overlap or move apart are left to the regular kernels.
+static float time_of_impact(float offset_x, float offset_y, float motion_x,
+                            float motion_y, float reach) {
+  float a = motion_x * motion_x + motion_y * motion_y;
+  float half_b = offset_x * motion_x + offset_y * motion_y;
+  float c = offset_x * offset_x + offset_y * offset_y - reach * reach;
+  if (c <= 0.0f || half_b >= 0.0f)
+    return -1.0f;
+
+  float discriminant = half_b * half_b - a * c;
+  if (discriminant < 0.0f)
+    return -1.0f;
+
+  float t = (-half_b - sqrtf(discriminant)) / a;
+  return t <= 1.0f ? t : -1.0f;
+}
+
+static int compare_fast(const void *a, const void *b) {
+  return ((const FastParticle *)a)->index - ((const FastParticle *)b)->index;
+}
+
+// Move a particle that was stopped short of its end position to the cell of
+// its contact position, so the collision phase finds it where it is
+static void rebin_particle(int i, float end_x, float end_y) {
+  Circle *p = &state.particles[i];
+  int from_x, from_y, to_x, to_y;
+  grid_coords(end_x, end_y, &from_x, &from_y);
+  grid_coords(p->xcenter, p->ycenter, &to_x, &to_y);
+  if (from_x == to_x && from_y == to_y)
+    return;
+
+  GridCell *from = &state.grid[from_y * state.grid_width + from_x];
+  GridCell *to = &state.grid[to_y * state.grid_width + to_x];
+  for (int c = 0; c < from->count; c++) {
+    if (from->particle_indices[c] != i)
+      continue;
+    from->particle_indices[c] = from->particle_indices[--from->count];
+    from->velocity_x_sum -= p->xvelocity;
+    from->velocity_y_sum -= p->yvelocity;
+    if (to->count < MAX_PARTICLES_PER_CELL) {
+      to->particle_indices[to->count++] = i;
+      to->velocity_x_sum += p->xvelocity;
+      to->velocity_y_sum += p->yvelocity;
+    } else {
+      state.diagnostics.grid_overflow++;
+    }
+    return;
+  }
+}
+
+// Sweep each fast particle from its start position to its end position
+// against the grid neighbours along the way, stop it at the first contact and
+// resolve that contact. Neighbours are taken at their end positions. Needs a
+// current grid, which is kept current by moving stopped particles to the cell
+// of their contact position.
+void handle_fast_particles(FastParticle *fast, int count) {
+  // Threads appended in any order; sort so the result does not depend on it
+  qsort(fast, count, sizeof(FastParticle), compare_fast);
+
+  for (int k = 0; k < count; k++) {
+    int i = fast[k].index;
+    Circle *p = &state.particles[i];
+    float start_x = fast[k].start_x;
+    float start_y = fast[k].start_y;
+    float motion_x = p->xcenter - start_x;
+    float motion_y = p->ycenter - start_y;
+
+    // Cells around the path, padded by a cell for the neighbours' radii
+    float pad = p->radius + GRID_CELL_SIZE;
+    int min_x, min_y, max_x, max_y;
+    grid_coords(fminf(start_x, p->xcenter) - pad,
+                fminf(start_y, p->ycenter) - pad, &min_x, &min_y);
+    grid_coords(fmaxf(start_x, p->xcenter) + pad,
+                fmaxf(start_y, p->ycenter) + pad, &max_x, &max_y);
+
+    float first_t = 2.0f;
+    int first = -1;
+    for (int y = min_y; y <= max_y; y++) {
+      for (int x = min_x; x <= max_x; x++) {
+        GridCell *cell = &state.grid[y * state.grid_width + x];
+        for (int c = 0; c < cell->count; c++) {
+          int j = cell->particle_indices[c];
+          if (j == i)
+            continue;
+
+          Circle *q = &state.particles[j];
+          float t = time_of_impact(start_x - q->xcenter, start_y - q->ycenter,
+                                   motion_x, motion_y, p->radius + q->radius);
+          if (t >= 0.0f && t < first_t) {
+            first_t = t;
+            first = j;
+          }
+        }
+      }
+    }
+
+    if (first < 0)
+      continue;
+
+    float length = sqrtf(motion_x * motion_x + motion_y * motion_y);
+    float t = fminf(first_t + CCD_CONTACT_SLOP / length, 1.0f);
+    float contact_x = start_x + motion_x * t;
+    float contact_y = start_y + motion_y * t;
+
+    float end_x = p->xcenter;
+    float end_y = p->ycenter;
+    p->dx += contact_x - end_x;
+    p->dy += contact_y - end_y;
+    p->xcenter = contact_x;
+    p->ycenter = contact_y;
+    rebin_particle(i, end_x, end_y);
+    handle_pair_collision(p, &state.particles[first]);
+  }
+}
@@ -0,0 +1,17 @@
+#ifndef CCD_H
+#define CCD_H
+
+#include "defs.h"
+
+// A particle that moved far enough in this step to need swept collisions
+typedef struct FastParticle {
+  int index;
+  float start_x; // position before the step
+  float start_y;
+} FastParticle;
+
+int is_fast_step(const Circle *particle, float start_x, float start_y);
+void handle_swept_border_collisions(Circle *particle);
+void handle_fast_particles(FastParticle *fast, int count);
+
+#endif
@@ -0,0 +1,409 @@
+#include <SDL2/SDL_timer.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+#include "constraints.h"
+#include "defs.h"
+#include "state.h"
+#include "util.h"
+
+extern State state;
+
+// Constraints as added, by particle id
+typedef struct ConstraintList {
+  int *id_a;
+  int *id_b;
+  float *rest;
+  int count;
+  int capacity;
+} ConstraintList;
+
+// CSR adjacency over the constrained particles (nodes). Nodes are grouped by
+// colour, and no two nodes of one colour share a constraint, so each colour
+// is relaxed in parallel.
+typedef struct ConstraintGraph {
+  int node_count;
+  int *node_id;    // particle id of each node
+  int *node_index; // particle index of each node this step, -1 if gone
+  int *row_start;  // node_count + 1 offsets into column and rest
+  int *column;     // neighbour node of each entry
+  float *rest;     // rest length of each entry
+  int color_count;
+  int color_start[CONSTRAINT_MAX_COLORS + 1];
+  int current; // built from the current list
+} ConstraintGraph;
+
+static ConstraintList list;
+static ConstraintGraph graph;
+static int *index_of_id;
+static int id_capacity;
+
+static void free_graph() {
+  free(graph.node_id);
+  free(graph.node_index);
+  free(graph.row_start);
+  free(graph.column);
+  free(graph.rest);
+  graph = (ConstraintGraph){0};
+}
+
+int add_constraint(int id_a, int id_b, float rest_length) {
+  if (id_a == id_b || id_a < 0 || id_b < 0 ||
+      id_a >= state.next_particle_id || id_b >= state.next_particle_id) {
+    printf("Invalid particle ids in add_constraint\n");
+    return -1;
+  }
+
+  if (list.count == list.capacity) {
+    int capacity = list.capacity ? 2 * list.capacity : 1024;
+    int *id_a_grown = realloc(list.id_a, capacity * sizeof(int));
+    if (id_a_grown)
+      list.id_a = id_a_grown;
+    int *id_b_grown = realloc(list.id_b, capacity * sizeof(int));
+    if (id_b_grown)
+      list.id_b = id_b_grown;
+    float *rest_grown = realloc(list.rest, capacity * sizeof(float));
+    if (rest_grown)
+      list.rest = rest_grown;
+    if (!id_a_grown || !id_b_grown || !rest_grown) {
+      printf("Memory allocation failed\n");
+      exit(1);
+    }
+    list.capacity = capacity;
+  }
+
+  list.id_a[list.count] = id_a;
+  list.id_b[list.count] = id_b;
+  list.rest[list.count] = rest_length;
+  list.count++;
+  graph.current = 0;
+  return 0;
+}
+
+int constraint_count() { return list.count; }
+
+void clear_constraints() {
+  list.count = 0;
+  graph.current = 0;
+}
+
+void cleanup_constraints() {
+  free(list.id_a);
+  free(list.id_b);
+  free(list.rest);
+  list = (ConstraintList){0};
+  free_graph();
+  free(index_of_id);
+  index_of_id = NULL;
+  id_capacity = 0;
+}
+
+// Greedy colouring in node order: each node takes the lowest colour none of
+// its already coloured neighbours has
+static int color_nodes(const int *row_start, const int *column, int count,
+                       int *color) {
+  int color_count = 0;
+  for (int n = 0; n < count; n++) {
+    uint32_t taken = 0;
+    for (int e = row_start[n]; e < row_start[n + 1]; e++) {
+      int c = color[column[e]];
+      if (c >= 0)
+        taken |= 1u << c;
+    }
+    int c = 0;
+    while (c < CONSTRAINT_MAX_COLORS && (taken & (1u << c)))
+      c++;
+    if (c == CONSTRAINT_MAX_COLORS)
+      return -1;
+    color[n] = c;
+    if (c + 1 > color_count)
+      color_count = c + 1;
+  }
+  return color_count;
+}
+
+// Scratch for a graph rebuild, indexed by particle id or by node
+typedef struct GraphScratch {
+  int *node_of_id;
+  int *order_id; // particle id of each node in id order
+  int *degree;
+  int *row_start;
+  int *column;
+  float *rest;
+  int *color;
+  int *position; // slot of each node once grouped by colour
+} GraphScratch;
+
+// Number the constrained ids in order and fill both directions of every
+// constraint into an id-ordered CSR adjacency. Returns the node count.
+static int build_id_order(GraphScratch *s, int ids) {
+  for (int id = 0; id < ids; id++) {
+    s->node_of_id[id] = -1;
+  }
+  for (int c = 0; c < list.count; c++) {
+    s->node_of_id[list.id_a[c]] = 0;
+    s->node_of_id[list.id_b[c]] = 0;
+  }
+  int count = 0;
+  for (int id = 0; id < ids; id++) {
+    if (s->node_of_id[id] == 0) {
+      s->node_of_id[id] = count;
+      s->order_id[count++] = id;
+    }
+  }
+
+  for (int c = 0; c < list.count; c++) {
+    s->degree[s->node_of_id[list.id_a[c]]]++;
+    s->degree[s->node_of_id[list.id_b[c]]]++;
+  }
+  s->row_start[0] = 0;
+  for (int n = 0; n < count; n++) {
+    s->row_start[n + 1] = s->row_start[n] + s->degree[n];
+    s->degree[n] = s->row_start[n]; // fill cursor
+  }
+  for (int c = 0; c < list.count; c++) {
+    int a = s->node_of_id[list.id_a[c]];
+    int b = s->node_of_id[list.id_b[c]];
+    s->column[s->degree[a]] = b;
+    s->rest[s->degree[a]++] = list.rest[c];
+    s->column[s->degree[b]] = a;
+    s->rest[s->degree[b]++] = list.rest[c];
+  }
+  return count;
+}
+
+// Colour the nodes and copy the adjacency into the graph, grouped by colour
+// and keeping id order within a colour
+static int build_colored_graph(GraphScratch *s, int count) {
+  for (int n = 0; n < count; n++) {
+    s->color[n] = -1;
+  }
+  int color_count = color_nodes(s->row_start, s->column, count, s->color);
+  if (color_count < 0) {
+    printf("Too many constraints on one particle\n");
+    return -1;
+  }
+
+  int color_start[CONSTRAINT_MAX_COLORS + 1] = {0};
+  for (int n = 0; n < count; n++) {
+    color_start[s->color[n] + 1]++;
+  }
+  for (int c = 0; c < color_count; c++) {
+    color_start[c + 1] += color_start[c];
+  }
+  for (int c = 0; c <= color_count; c++) {
+    graph.color_start[c] = color_start[c];
+  }
+  for (int n = 0; n < count; n++) {
+    s->position[n] = color_start[s->color[n]]++;
+  }
+
+  graph.node_id = malloc(count * sizeof(int));
+  graph.node_index = malloc(count * sizeof(int));
+  graph.row_start = malloc((count + 1) * sizeof(int));
+  graph.column = malloc(2 * list.count * sizeof(int));
+  graph.rest = malloc(2 * list.count * sizeof(float));
+  if (!graph.node_id || !graph.node_index || !graph.row_start ||
+      !graph.column || !graph.rest) {
+    printf("Memory allocation failed\n");
+    return -1;
+  }
+
+  for (int n = 0; n < count; n++) {
+    graph.node_id[s->position[n]] = s->order_id[n];
+    s->degree[s->position[n]] = s->row_start[n + 1] - s->row_start[n];
+  }
+  graph.row_start[0] = 0;
+  for (int p = 0; p < count; p++) {
+    graph.row_start[p + 1] = graph.row_start[p] + s->degree[p];
+  }
+  for (int n = 0; n < count; n++) {
+    int out = graph.row_start[s->position[n]];
+    for (int e = s->row_start[n]; e < s->row_start[n + 1]; e++, out++) {
+      graph.column[out] = s->position[s->column[e]];
+      graph.rest[out] = s->rest[e];
+    }
+  }
+
+  graph.node_count = count;
+  graph.color_count = color_count;
+  graph.current = 1;
+  return 0;
+}
+
+// Rebuild the graph from the list. Runs only when constraints were added.
+static int build_graph() {
+  int ids = state.next_particle_id;
+  GraphScratch s = {malloc(ids * sizeof(int)),
+                    malloc(ids * sizeof(int)),
+                    calloc(ids + 1, sizeof(int)),
+                    malloc((ids + 1) * sizeof(int)),
+                    malloc(2 * list.count * sizeof(int)),
+                    malloc(2 * list.count * sizeof(float)),
+                    malloc(ids * sizeof(int)),
+                    malloc(ids * sizeof(int))};
+  int result = -1;
+
+  free_graph();
+  if (s.node_of_id && s.order_id && s.degree && s.row_start && s.column &&
+      s.rest && s.color && s.position) {
+    result = build_colored_graph(&s, build_id_order(&s, ids));
+  } else {
+    printf("Memory allocation failed\n");
+  }
+  if (result < 0) {
+    free_graph();
+  }
+
+  free(s.node_of_id);
+  free(s.order_id);
+  free(s.degree);
+  free(s.row_start);
+  free(s.column);
+  free(s.rest);
+  free(s.color);
+  free(s.position);
+  return result;
+}
+
+// Look up where every constrained particle sits in the array this step
+static int resolve_nodes() {
+  int ids = state.next_particle_id;
+  if (ids > id_capacity) {
+    int *grown = realloc(index_of_id, ids * sizeof(int));
+    if (!grown) {
+      printf("Memory allocation failed\n");
+      return -1;
+    }
+    index_of_id = grown;
+    id_capacity = ids;
+  }
+
+#pragma omp parallel
+  {
+#pragma omp for schedule(static, PARTICLE_CHUNK)
+    for (int id = 0; id < ids; id++) {
+      index_of_id[id] = -1;
+    }
+#pragma omp for schedule(static, PARTICLE_CHUNK)
+    for (int i = 0; i < state.particle_count; i++) {
+      int id = state.particles[i].id;
+      if (id >= 0 && id < ids)
+        index_of_id[id] = i;
+    }
+#pragma omp for schedule(static)
+    for (int n = 0; n < graph.node_count; n++) {
+      graph.node_index[n] = index_of_id[graph.node_id[n]];
+    }
+  }
+  return 0;
+}
+
+// Move one node towards satisfying all of its constraints. Its share of each
+// error follows the inverse masses, and the neighbours move in their own
+// colour's pass. The correction also goes into the velocity, as in
+// position-based dynamics.
+static void relax_node(int n, float inv_dt) {
+  int i = graph.node_index[n];
+  if (i < 0)
+    return;
+
+  Circle *p = &state.particles[i];
+  float inv_mass = 1.0f / p->m;
+  float correction_x = 0.0f;
+  float correction_y = 0.0f;
+  int active = 0;
+  for (int e = graph.row_start[n]; e < graph.row_start[n + 1]; e++) {
+    int j = graph.node_index[graph.column[e]];
+    if (j < 0)
+      continue;
+    Circle *q = &state.particles[j];
+    float dx = p->xcenter - q->xcenter;
+    float dy = p->ycenter - q->ycenter;
+    float distance = sqrtf(dx * dx + dy * dy);
+    if (distance <= 0.0f)
+      continue;
+
+    float share = inv_mass / (inv_mass + 1.0f / q->m);
+    float scale = -share * (distance - graph.rest[e]) / distance;
+    correction_x += scale * dx;
+    correction_y += scale * dy;
+    active++;
+  }
+  if (active == 0)
+    return;
+
+  correction_x *= CONSTRAINT_RELAXATION / active;
+  correction_y *= CONSTRAINT_RELAXATION / active;
+  p->xcenter += correction_x;
+  p->ycenter += correction_y;
+  p->dx += correction_x;
+  p->dy += correction_y;
+  p->xvelocity += correction_x * inv_dt;
+  p->yvelocity += correction_y * inv_dt;
+}
+
+void solve_constraints() {
+  if (list.count == 0 || state.step_dt <= 0.0f)
+    return;
+  if (!graph.current && build_graph() < 0) {
+    clear_constraints();
+    return;
+  }
+  if (resolve_nodes() < 0)
+    return;
+
+  float inv_dt = 1.0f / state.step_dt;
+#pragma omp parallel
+  for (int iteration = 0; iteration < CONSTRAINT_ITERATIONS; iteration++) {
+    for (int c = 0; c < graph.color_count; c++) {
+#pragma omp for schedule(static)
+      for (int n = graph.color_start[c]; n < graph.color_start[c + 1]; n++) {
+        relax_node(n, inv_dt);
+      }
+    }
+  }
+}
+
+int spawn_soft_body(float x, float y, int side) {
+  if (side < 2 || allocator_free_slots() < side * side) {
+    return -1;
+  }
+
+  int first_id = state.next_particle_id;
+  Color color = generate_random_color();
+  for (int r = 0; r < side; r++) {
+    for (int c = 0; c < side; c++) {
+      Circle particle = {.xcenter = x + c * SOFT_BODY_SPACING,
+                         .ycenter = y + r * SOFT_BODY_SPACING,
+                         .radius = PARTICLE_RADIUS,
+                         .m = PARTICLE_MASS,
+                         .cor = PARTICLE_COR,
+                         .color = color,
+                         .id = state.next_particle_id++,
+                         .lastupdated = SDL_GetTicks()};
+      add_particle(particle);
+    }
+  }
+
+  // Structural springs to the right and below, shear springs on both
+  // diagonals of every square
+  float diagonal = SOFT_BODY_SPACING * sqrtf(2.0f);
+  for (int r = 0; r < side; r++) {
+    for (int c = 0; c < side; c++) {
+      int id = first_id + r * side + c;
+      if (c + 1 < side)
+        add_constraint(id, id + 1, SOFT_BODY_SPACING);
+      if (r + 1 < side)
+        add_constraint(id, id + side, SOFT_BODY_SPACING);
+      if (r + 1 < side && c + 1 < side)
+        add_constraint(id, id + side + 1, diagonal);
+      if (r + 1 < side && c > 0)
+        add_constraint(id, id + side - 1, diagonal);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef CONSTRAINTS_H
+#define CONSTRAINTS_H
+
+// Distance constraints between particle ids. Ids survive allocator recycling
+// and reordering of the particle array. A constraint whose particle is gone
+// is skipped.
+
+int add_constraint(int id_a, int id_b, float rest_length);
+int constraint_count();
+void clear_constraints();
+void cleanup_constraints();
+
+// Relax all constraints, called by update_state() after the collision phase
+void solve_constraints();
+
+// A square of side x side particles with its top-left corner at (x, y), held
+// together by springs to its lattice and diagonal neighbours
+int spawn_soft_body(float x, float y, int side);
+
+#endif
@@ -35,17 +35,113 @@
 #define SOURCE_FLOW_RATE 200.0f
 #define SOURCE_VELOCITY_MAGNITUDE 40.0f
 #define PARTICLE_RADIUS 2.0f
+#define PARTICLE_MASS 20.0f
+#define PARTICLE_COR 0.80f
 #define USE_RANDOM_COLORS 1 // Set to 1 for random colors, 0 for default color
 
 #define SETTINGS_PANEL_WIDTH 250
 #define SETTINGS_PANEL_HEIGHT 450
 #define SETTINGS_PANEL_MARGIN 10
 
+// Particle count from which particles are splatted into a streaming texture
+// instead of drawn as textured quads
+#define SPLAT_THRESHOLD 5000
+
+// Heat map: particles per cell and mean speed in pixels/s shown at full heat
+#define HEAT_DENSITY_SCALE 4.0f
+#define HEAT_SPEED_SCALE 100.0f
+
 #define GRID_CELL_SIZE 8
-#define GRID_WIDTH (SCREEN_WIDTH / GRID_CELL_SIZE)
-#define GRID_HEIGHT (SCREEN_HEIGHT / GRID_CELL_SIZE)
 #define MAX_PARTICLES_PER_CELL 32
 
+// Verlet neighbour lists: pairs closer than their radii plus the skin are
+// listed, and the lists are rebuilt once any particle has moved half the skin
+#define NEIGHBOUR_SKIN 2.0f
+
+// Continuous collision detection: particles that move more than this fraction
+// of their radius in one step are swept against the walls and their neighbours
+#define CCD_FAST_FRACTION 1.0f
+
+// Static obstacles: the signed distance field has one sample every
+// OBSTACLE_SDF_SPACING pixels, half a grid cell, so that polyline walls
+// OBSTACLE_LINE_WIDTH pixels wide still have samples well inside them. Bitmap
+// pixels darker than the threshold are solid.
+#define OBSTACLE_SDF_SPACING (GRID_CELL_SIZE / 2)
+#define OBSTACLE_LINE_WIDTH ((float)GRID_CELL_SIZE)
+#define OBSTACLE_BITMAP_THRESHOLD 128
+
+// Collision load balancing: the grid is cut into square tiles of this many
+// cells, which are handed to threads dynamically, most expensive first
+#define COLLISION_TILE_SIZE 4
+#define MAX_TIMED_THREADS 256
+
+// Particles per static OpenMP chunk. Every loop over particles and the
+// first-touch initialization of particle buffers use the same chunking, so a
+// thread works on the pages it placed in its own NUMA node.
+#define PARTICLE_CHUNK 1024
+
+// Frame-budget governor: quality drops a level when the smoothed frame time
+// exceeds the budget and comes back once it falls below the headroom fraction
+#define FRAME_BUDGET_MS 16.6f
+#define GOVERNOR_HEADROOM 0.7f
+#define GOVERNOR_SMOOTHING 0.1f    // weight of the newest frame in the average
+#define GOVERNOR_COOLDOWN_FRAMES 30 // frames to settle after a level change
+#define GOVERNOR_EMISSION_THROTTLE 4.0f // spawn interval multiplier
+
+// SPH fluid: smoothing length in pixels (one grid cell, so the 3x3 cells
+// around a particle hold all its neighbours), rest spacing of the particles,
+// rest density, pressure stiffness in pixels^2/s^2 and viscosity in
+// pixels^2/s. Particle mass follows from spacing and rest density.
+#define SPH_SMOOTHING_LENGTH ((float)GRID_CELL_SIZE)
+#define SPH_SPACING (2.0f * PARTICLE_RADIUS)
+#define SPH_REST_DENSITY 1.0f
+#define SPH_STIFFNESS 2000.0f
+#define SPH_VISCOSITY 20.0f
+// Longest wall-clock step the force and constraint solvers take
+#define FORCE_MAX_DT (1.0f / 30.0f)
+
+// Barnes-Hut long-range forces: a tree node stands in for its particles once
+// its size over their distance falls below the opening angle theta. Leaves
+// hold up to BARNES_HUT_LEAF_SIZE particles, and the softening length in
+// pixels keeps close encounters finite. The gravitational constant is in
+// pixels^3/(mass s^2), the Coulomb constant in pixels^3 mass/(charge^2 s^2).
+#define BARNES_HUT_THETA 0.5f
+#define BARNES_HUT_LEAF_SIZE 8
+#define BARNES_HUT_SOFTENING 4.0f
+#define GRAVITATIONAL_CONSTANT 5.0f
+#define COULOMB_CONSTANT 2000.0f
+
+// Distance constraints: Gauss-Seidel sweeps per step, over-relaxation of the
+// averaged per-particle correction, and at most this many colours, so a
+// particle can have up to CONSTRAINT_MAX_COLORS - 1 constraints
+#define CONSTRAINT_ITERATIONS 4
+#define CONSTRAINT_RELAXATION 1.5f
+#define CONSTRAINT_MAX_COLORS 32
+// Spawned soft bodies: particles per side and lattice spacing in pixels, far
+// enough apart that their own contacts stay quiet
+#define SOFT_BODY_SIZE 6
+#define SOFT_BODY_SPACING (3.0f * PARTICLE_RADIUS)
+
+// Mouse brush: reach in pixels, acceleration at the cursor in pixels/s^2 and
+// the rate per second at which dragged particles take on the cursor velocity
+#define BRUSH_RADIUS 40.0f
+#define BRUSH_ACCELERATION 2000.0f
+#define BRUSH_DRAG_RATE 10.0f
+
+// Deterministic (lockstep) mode
+#define DETERMINISTIC_DT (1.0f / 60.0f) // fixed step in seconds
+#define DETERMINISTIC_SEED 12345u
+
+// Frame capture
+#define CAPTURE_QUEUE_DEPTH 8     // frames read back but not yet on disk
+#define CAPTURE_ENCODER_THREADS 2 // background threads encoding frames
+
+// Domain decomposition (vertical strips owned by worker processes)
+#define DOMAIN_MAX_STRIPS 64
+#define DOMAIN_HALO_WIDTH GRID_CELL_SIZE // halo band on each side of a strip
+#define DOMAIN_MAX_HALO 2048             // halo particles per side per step
+#define DOMAIN_MAX_MIGRANTS 1024         // leaving particles per side per step
+
 typedef struct Circle {
   float xcenter;
   float ycenter;
@@ -58,6 +154,7 @@ typedef struct Circle {
   float m; // mass
   float
       cor; // coefficient of restitution (0.0 = no bounce, 1.0 = perfect bounce)
+  float charge; // for the electrostatic long-range force
   Color color;
   int id;
 } Circle;
@@ -65,6 +162,8 @@ typedef struct Circle {
 typedef struct GridCell {
   int particle_indices[MAX_PARTICLES_PER_CELL];
   int count;
+  float velocity_x_sum; // of the listed particles, for the heat map
+  float velocity_y_sum;
 } GridCell;
 
 typedef enum EmitterSide {
@@ -74,6 +173,14 @@ typedef enum EmitterSide {
   EMITTER_BOTTOM
 } EmitterSide;
 
+// Signed distance to the static obstacles, negative inside them, sampled
+// every OBSTACLE_SDF_SPACING pixels
+typedef struct ObstacleMap {
+  float *distance; // height rows of width samples, NULL without obstacles
+  int width;
+  int height;
+} ObstacleMap;
+
 typedef struct ParticleSource {
   float x, y;               // Position of the source
   float width, height;      // Size of the source area
@@ -82,9 +189,58 @@ typedef struct ParticleSource {
   float last_spawn_time;    // Time tracking for generation
   int is_active;            // Whether source is generating particles
   int particles_spawned;    // Count of particles generated by this source
+  int max_particles;        // Source switches off after this many
   EmitterSide emitter_side; // Which side of the rectangle emits particles
 } ParticleSource;
 
+typedef enum BroadPhase {
+  BROAD_PHASE_GRID,          // rebuild the grid and scan cell pairs every step
+  BROAD_PHASE_NEIGHBOUR_LIST, // Verlet lists, rebuilt from the grid when stale
+  BROAD_PHASE_SWEEP,          // sort and sweep along x, no grid
+  BROAD_PHASE_COUNT
+} BroadPhase;
+
+typedef enum RenderMode {
+  RENDER_PARTICLES,
+  RENDER_DENSITY, // heat map of particles per grid cell
+  RENDER_SPEED,   // heat map of the mean velocity per grid cell
+  RENDER_MODE_COUNT
+} RenderMode;
+
+// Each level keeps the reductions of the levels above it
+typedef enum QualityLevel {
+  QUALITY_FULL,
+  QUALITY_NO_VECTORS, // velocity vector overlay skipped
+  QUALITY_THROTTLED,  // emitter spawns GOVERNOR_EMISSION_THROTTLE times slower
+  QUALITY_DECIMATED,  // only every other frame is rendered
+  QUALITY_LEVEL_COUNT
+} QualityLevel;
+
+typedef enum PhysicsModel {
+  MODEL_RIGID, // elastic collisions between circles
+  MODEL_SPH,   // smoothed-particle hydrodynamics fluid
+  MODEL_COUNT
+} PhysicsModel;
+
+typedef enum LongRangeForce {
+  LONG_RANGE_NONE,
+  LONG_RANGE_GRAVITY,       // mutual attraction between the masses
+  LONG_RANGE_ELECTROSTATIC, // like charges repel, opposite charges attract
+  LONG_RANGE_COUNT
+} LongRangeForce;
+
+typedef enum BrushTool {
+  BRUSH_ATTRACT,
+  BRUSH_REPEL,
+  BRUSH_DRAG, // particles follow the cursor
+  BRUSH_TOOL_COUNT
+} BrushTool;
+
+typedef enum CollisionSchedule {
+  SCHEDULE_COST,  // cost-weighted tiles on a dynamic schedule
+  SCHEDULE_STATIC // equal blocks of cells per thread
+} CollisionSchedule;
+
 typedef struct Settings {
   float gravity;
   int num_particles;
@@ -93,46 +249,86 @@ typedef struct Settings {
   int show_settings;
   int is_paused;
   int show_velocity_vectors;
+  QualityLevel quality_level; // set by the frame-budget governor
+  RenderMode render_mode;
+  // Run mode, configured once in main() and preserved across resets
+  int deterministic; // fixed dt, seeded RNG and ordered contact resolution
+  float fixed_dt;    // seconds per step, 0 = use wall-clock time
+  uint32_t seed;
+  PhysicsModel model;
+  LongRangeForce long_range;
+  float theta; // Barnes-Hut opening angle
+  BroadPhase broad_phase;
+  CollisionSchedule collision_schedule;
+  float frame_budget_ms; // governor target, 0 = governor off
+  int splat_threshold;   // splat from this many particles, -1 = never
+  int diagnostics;       // sum the conservation diagnostics every step
 } Settings;
 
-typedef struct UICache {
-  // Static UI textures (created once)
-  SDL_Texture *controls_label;
-  SDL_Texture *space_help;
-  SDL_Texture *step_help;
-  SDL_Texture *reset_help;
-  SDL_Texture *vectors_help;
-  SDL_Texture *settings_help;
-  SDL_Texture *quit_help;
-  
-  // Dynamic UI textures with cached values
-  SDL_Texture *fps_texture;
-  float last_fps;
-  SDL_Texture *particles_texture;
-  int last_particle_count;
-  SDL_Texture *status_texture;
-  int last_paused_state;
-} UICache;
+typedef struct Brush {
+  int active; // mouse button held
+  BrushTool tool;
+  float x; // cursor position
+  float y;
+  float radius;
+} Brush;
+
+typedef struct PhaseTimings {
+  double integrate_ms;
+  double grid_ms;
+  double collide_ms;
+  double constraint_ms;
+  int threads; // threads that took part in the last grid collision phase
+  double thread_busy_ms[MAX_TIMED_THREADS]; // collision work of each thread
+} PhaseTimings;
+
+// Conservation and overlap figures of the last step. The sums are taken in
+// the integration loop, so they see the particles before contact resolution.
+typedef struct Diagnostics {
+  double kinetic_energy;   // 0.5 m v^2 over all particles
+  double potential_energy; // m g h, h measured up from the floor
+  double momentum_x;
+  double momentum_y;
+  float max_penetration; // deepest contact resolved, in pixels
+  int grid_overflow;     // particles left out of full cells by the last grid
+} Diagnostics;
 
 typedef struct State {
   SDL_Renderer *renderer;
   SDL_Window *window;
   Circle *particles;
   int particle_count;
-  GridCell grid[GRID_HEIGHT][GRID_WIDTH];
+  int uniform_particles; // every particle has the default radius, m and cor
+  GridCell *grid; // grid_height rows of grid_width cells
+  int grid_current; // grid lists the current particles, as of their last step
+  int grid_width;
+  int grid_height;
+  int world_width;
+  int world_height;
+  ObstacleMap obstacles;
   float fps;
   Uint32 last_fps_update;
   int frame_count;
+  float sim_time;      // simulated seconds, advanced in fixed-dt mode
+  float step_dt;       // seconds covered by the current step, for the solvers
+  Uint32 last_step_ticks;
+  int next_particle_id; // ids below this have been handed out
+  uint64_t state_hash; // hash of particle state after the last step
   TTF_Font *font;
   Settings settings;
   ParticleSource source;
-  SDL_Texture *circle_texture;
-  int circle_texture_size;
+  Brush brush;
+  SDL_Texture *sprite_atlas; // anti-aliased discs for the particle radii
+  SDL_Texture *splat_texture; // screen-sized streaming texture
+  SDL_Texture *heat_texture;  // streaming texture with one pixel per cell
+  SDL_Texture *glyph_atlas;   // printable ASCII glyphs of the font
+  SDL_Texture *obstacle_texture; // obstacle coverage over the world
   SDL_Vertex *vertices;
   int *indices;
   int max_vertices;
   int max_indices;
-  UICache ui_cache;
+  PhaseTimings timings;
+  Diagnostics diagnostics;
 } State;
 
 #endif
@@ -0,0 +1,473 @@
+#include <SDL2/SDL.h>
+#include <omp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "defs.h"
+#include "domain.h"
+#include "draw.h"
+#include "obstacle.h"
+#include "scenario.h"
+#include "state.h"
+
+extern State state;
+
+#define SIDE_LEFT 0
+#define SIDE_RIGHT 1
+
+// Per-strip mailboxes. Each strip writes only its own entry; neighbours and
+// the coordinator read it between barriers.
+typedef struct StripExchange {
+  int halo_count[2];
+  Circle halo[2][DOMAIN_MAX_HALO]; // owned particles near each edge
+  int migrant_count[2];
+  Circle migrants[2][DOMAIN_MAX_MIGRANTS]; // particles that left the strip
+  int frame_count;   // owned particles in the frame buffer
+  int dropped_halo;  // halo particles that did not fit
+  volatile int ready; // 1 once set up, -1 if setup failed
+} StripExchange;
+
+typedef struct DomainShared {
+  pthread_barrier_t exchange_barrier; // workers only
+  pthread_barrier_t frame_ready;      // workers and coordinator
+  pthread_barrier_t frame_consumed;   // workers and coordinator
+  volatile int running;
+  int num_strips;
+  StripExchange strips[];
+} DomainShared;
+
+static DomainShared *shared;
+static Circle *frames; // num_strips * capacity, one slice per strip
+static int capacity;   // particles in the whole run, from the scenario
+static const char *extra_obstacles; // --obstacles, or NULL
+
+static void *shared_alloc(size_t size) {
+  void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  return memory == MAP_FAILED ? NULL : memory;
+}
+
+static size_t shared_size(int num_strips) {
+  return sizeof(DomainShared) + num_strips * sizeof(StripExchange);
+}
+
+static size_t frames_size(int num_strips) {
+  return (size_t)num_strips * capacity * sizeof(Circle);
+}
+
+static float strip_left(int strip) {
+  return (float)state.world_width * strip / shared->num_strips;
+}
+
+static float strip_right(int strip) {
+  return (float)state.world_width * (strip + 1) / shared->num_strips;
+}
+
+// Exchange primitives. Everything a strip sends or receives goes through these
+// three functions, so running strips on other nodes only means replacing them
+// with a socket or MPI transport.
+
+static void exchange_barrier() {
+  pthread_barrier_wait(&shared->exchange_barrier);
+}
+
+static int exchange_send(int strip, int side, const Circle *particles,
+                         int count, int halo) {
+  StripExchange *box = &shared->strips[strip];
+  int capacity = halo ? DOMAIN_MAX_HALO : DOMAIN_MAX_MIGRANTS;
+  Circle *slots = halo ? box->halo[side] : box->migrants[side];
+  if (count > capacity)
+    count = capacity;
+
+  memcpy(slots, particles, count * sizeof(Circle));
+  if (halo)
+    box->halo_count[side] = count;
+  else
+    box->migrant_count[side] = count;
+  return count;
+}
+
+static int exchange_receive(int strip, int side, Circle **particles, int halo) {
+  StripExchange *box = &shared->strips[strip];
+  *particles = halo ? box->halo[side] : box->migrants[side];
+  return halo ? box->halo_count[side] : box->migrant_count[side];
+}
+
+// Import the neighbours' edge particles as ghosts after the owned particles.
+// Ghosts take part in collisions but are dropped again after the step.
+static void import_ghosts(int strip) {
+  Circle *ghosts;
+  int count;
+
+  if (strip > 0) {
+    count = exchange_receive(strip - 1, SIDE_RIGHT, &ghosts, 1);
+    for (int i = 0; i < count; i++)
+      add_particle(ghosts[i]);
+  }
+  if (strip < shared->num_strips - 1) {
+    count = exchange_receive(strip + 1, SIDE_LEFT, &ghosts, 1);
+    for (int i = 0; i < count; i++)
+      add_particle(ghosts[i]);
+  }
+}
+
+static void publish_halo(int strip, Circle *scratch) {
+  float left = strip_left(strip);
+  float right = strip_right(strip);
+  StripExchange *box = &shared->strips[strip];
+
+  for (int side = SIDE_LEFT; side <= SIDE_RIGHT; side++) {
+    int count = 0;
+    for (int i = 0; i < state.particle_count; i++) {
+      float x = state.particles[i].xcenter;
+      int in_band = side == SIDE_LEFT ? x < left + DOMAIN_HALO_WIDTH
+                                      : x >= right - DOMAIN_HALO_WIDTH;
+      if (in_band && count < DOMAIN_MAX_HALO) {
+        scratch[count++] = state.particles[i];
+      } else if (in_band) {
+        box->dropped_halo++;
+      }
+    }
+    exchange_send(strip, side, scratch, count, 1);
+  }
+}
+
+// Hand particles that crossed a strip edge to the neighbour. A particle that
+// does not fit in this frame's mailbox stays put and leaves on the next frame.
+static void emigrate(int strip, Circle *scratch) {
+  float left = strip_left(strip);
+  float right = strip_right(strip);
+
+  for (int side = SIDE_LEFT; side <= SIDE_RIGHT; side++) {
+    int neighbour = side == SIDE_LEFT ? strip - 1 : strip + 1;
+    int count = 0;
+
+    if (neighbour >= 0 && neighbour < shared->num_strips) {
+      for (int i = state.particle_count - 1; i >= 0; i--) {
+        float x = state.particles[i].xcenter;
+        int outside = side == SIDE_LEFT ? x < left : x >= right;
+        if (outside && count < DOMAIN_MAX_MIGRANTS) {
+          scratch[count++] = state.particles[i];
+          remove_particle(i);
+        }
+      }
+    }
+    exchange_send(strip, side, scratch, count, 0);
+  }
+}
+
+static void immigrate(int strip) {
+  Circle *incoming;
+  int count;
+
+  if (strip > 0) {
+    count = exchange_receive(strip - 1, SIDE_RIGHT, &incoming, 0);
+    for (int i = 0; i < count; i++)
+      add_particle(incoming[i]);
+  }
+  if (strip < shared->num_strips - 1) {
+    count = exchange_receive(strip + 1, SIDE_LEFT, &incoming, 0);
+    for (int i = 0; i < count; i++)
+      add_particle(incoming[i]);
+  }
+}
+
+// The scenario's world plus any --obstacles file, with a pool of pool_size
+static int init_domain_world(int pool_size) {
+  if (init_scenario_world(pool_size) < 0)
+    return -1;
+  if (extra_obstacles && load_obstacles(extra_obstacles) < 0)
+    return -1;
+  return 0;
+}
+
+// Keep only the scenario particles that start inside this strip
+static void drop_foreign_particles(int strip) {
+  float left = strip_left(strip);
+  float right = strip_right(strip);
+  int kept = 0;
+
+  for (int i = 0; i < state.particle_count; i++) {
+    float x = state.particles[i].xcenter;
+    int last = strip == shared->num_strips - 1;
+    if ((x >= left || strip == 0) && (x < right || last)) {
+      state.particles[kept++] = state.particles[i];
+    }
+  }
+  while (state.particle_count > kept) {
+    remove_particle(state.particle_count - 1);
+  }
+}
+
+static void run_worker(int strip, int threads) {
+  Circle *scratch = malloc(DOMAIN_MAX_HALO * sizeof(Circle));
+  Circle *frame = frames + (size_t)strip * capacity;
+  StripExchange *box = &shared->strips[strip];
+
+  omp_set_num_threads(threads);
+  allocator_bind_threads();
+
+  // Room for every particle of the run plus ghosts from both neighbours. The
+  // coordinator waits for every strip to report before the first barrier.
+  if (!scratch || init_domain_world(capacity + 2 * DOMAIN_MAX_HALO) < 0) {
+    printf("Strip %d: failed to set up its world\n", strip);
+    fflush(stdout);
+    box->ready = -1;
+    _exit(1);
+  }
+
+  init_state();
+  drop_foreign_particles(strip);
+
+  // Only the strip containing the emitter spawns particles
+  float spawn_x = state.source.x + state.source.width;
+  if (spawn_x < strip_left(strip) || spawn_x >= strip_right(strip)) {
+    state.source.is_active = 0;
+  }
+  box->ready = 1;
+
+  while (1) {
+    update_particle_source();
+
+    publish_halo(strip, scratch);
+    exchange_barrier();
+
+    int owned = state.particle_count;
+    import_ghosts(strip);
+    update_state();
+    while (state.particle_count > owned) {
+      remove_particle(state.particle_count - 1);
+    }
+
+    emigrate(strip, scratch);
+    exchange_barrier();
+    immigrate(strip);
+
+    memcpy(frame, state.particles, state.particle_count * sizeof(Circle));
+    box->frame_count = state.particle_count;
+
+    pthread_barrier_wait(&shared->frame_ready);
+    pthread_barrier_wait(&shared->frame_consumed);
+    if (!shared->running)
+      break;
+  }
+
+  free(scratch);
+  cleanup_world();
+  allocator_cleanup();
+  _exit(0);
+}
+
+// Copy every strip's frame into the coordinator's particle array for rendering.
+// Fails if the strips together hold more particles than the run's capacity.
+static int assemble_frame() {
+  int total = 0;
+  for (int s = 0; s < shared->num_strips; s++) {
+    total += shared->strips[s].frame_count;
+  }
+  if (total > capacity) {
+    printf("Strips hold %d particles, more than the capacity of %d\n", total,
+           capacity);
+    return -1;
+  }
+
+  total = 0;
+  for (int s = 0; s < shared->num_strips; s++) {
+    int count = shared->strips[s].frame_count;
+    memcpy(&state.particles[total], frames + (size_t)s * capacity,
+           count * sizeof(Circle));
+    total += count;
+  }
+  state.particle_count = total;
+  state.source.particles_spawned = total;
+  return 0;
+}
+
+// Wait until every forked strip has set up its world. Returns -1 if a strip
+// failed or exited before reporting.
+static int wait_for_workers(pid_t *workers, int count) {
+  int pending = count;
+  while (pending > 0) {
+    pending = 0;
+    for (int s = 0; s < count; s++) {
+      int ready = shared->strips[s].ready;
+      if (ready < 0 || (ready == 0 && waitpid(workers[s], NULL, WNOHANG))) {
+        printf("Worker for strip %d failed to start\n", s);
+        return -1;
+      }
+      pending += ready == 0;
+    }
+    if (pending > 0)
+      usleep(1000);
+  }
+  return 0;
+}
+
+// Kill workers that are (or may be) waiting on a barrier that can no longer
+// complete, and reap them
+static void stop_workers(pid_t *workers, int count) {
+  shared->running = 0;
+  for (int s = 0; s < count; s++) {
+    kill(workers[s], SIGKILL);
+  }
+  for (int s = 0; s < count; s++) {
+    waitpid(workers[s], NULL, 0);
+  }
+}
+
+static void unmap_shared(int num_strips) {
+  pthread_barrier_destroy(&shared->exchange_barrier);
+  pthread_barrier_destroy(&shared->frame_ready);
+  pthread_barrier_destroy(&shared->frame_consumed);
+  munmap(frames, frames_size(num_strips));
+  munmap(shared, shared_size(num_strips));
+}
+
+static int handle_coordinator_events() {
+  SDL_Event e;
+  while (SDL_PollEvent(&e) != 0) {
+    if (e.type == SDL_QUIT)
+      return 0;
+    if (e.type == SDL_KEYDOWN) {
+      switch (e.key.keysym.sym) {
+      case SDLK_q:
+        return 0;
+      case SDLK_s:
+        state.settings.show_settings = !state.settings.show_settings;
+        break;
+      case SDLK_v:
+        state.settings.show_velocity_vectors =
+            !state.settings.show_velocity_vectors;
+        break;
+      }
+    }
+  }
+  return 1;
+}
+
+int run_domains(int num_strips, int frame_limit, const char *obstacle_path) {
+  if (num_strips < 1 || num_strips > DOMAIN_MAX_STRIPS) {
+    printf("Number of strips must be between 1 and %d\n", DOMAIN_MAX_STRIPS);
+    return -1;
+  }
+
+  int width, height;
+  scenario_dimensions(&width, &height, &capacity);
+  extra_obstacles = obstacle_path;
+
+  shared = shared_alloc(shared_size(num_strips));
+  frames = shared_alloc(frames_size(num_strips));
+  if (!shared || !frames) {
+    printf("Failed to map shared memory for %d strips\n", num_strips);
+    return -1;
+  }
+  shared->num_strips = num_strips;
+  shared->running = 1;
+
+  pthread_barrierattr_t attr;
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_barrier_init(&shared->exchange_barrier, &attr, num_strips);
+  pthread_barrier_init(&shared->frame_ready, &attr, num_strips + 1);
+  pthread_barrier_init(&shared->frame_consumed, &attr, num_strips + 1);
+  pthread_barrierattr_destroy(&attr);
+
+  // Strips exchange state every step, so they must advance in lockstep
+  if (state.settings.fixed_dt <= 0.0f) {
+    state.settings.fixed_dt = DETERMINISTIC_DT;
+  }
+
+  // Fork before any OpenMP region or SDL window exists in this process
+  int threads = omp_get_max_threads() / num_strips;
+  if (threads < 1)
+    threads = 1;
+
+  pid_t workers[DOMAIN_MAX_STRIPS];
+  for (int s = 0; s < num_strips; s++) {
+    workers[s] = fork();
+    if (workers[s] < 0) {
+      printf("Failed to fork worker for strip %d\n", s);
+      stop_workers(workers, s);
+      unmap_shared(num_strips);
+      return -1;
+    }
+    if (workers[s] == 0) {
+      run_worker(s, threads);
+    }
+  }
+
+  int headless = frame_limit > 0;
+  if (wait_for_workers(workers, num_strips) < 0 ||
+      init_domain_world(capacity) < 0) {
+    printf("Failed to start %d strips\n", num_strips);
+    stop_workers(workers, num_strips);
+    unmap_shared(num_strips);
+    cleanup_world();
+    allocator_cleanup();
+    return -1;
+  }
+  if (!headless && setup(0) > 0) {
+    stop_workers(workers, num_strips);
+    unmap_shared(num_strips);
+    cleanup_world();
+    allocator_cleanup();
+    return -1;
+  }
+  init_state();
+
+  printf("Running %d strips with %d threads each\n", num_strips, threads);
+  Uint32 start = SDL_GetTicks();
+  int frame = 0;
+  int result = 0;
+  while (shared->running) {
+    pthread_barrier_wait(&shared->frame_ready);
+    if (assemble_frame() < 0) {
+      result = -1;
+      shared->running = 0;
+    }
+    frame++;
+
+    if (headless) {
+      if (frame >= frame_limit)
+        shared->running = 0;
+    } else if (!handle_coordinator_events()) {
+      shared->running = 0;
+    }
+    pthread_barrier_wait(&shared->frame_consumed);
+
+    if (!headless) {
+      clear_screen();
+      update_fps();
+      render();
+    }
+  }
+
+  for (int s = 0; s < num_strips; s++) {
+    waitpid(workers[s], NULL, 0);
+  }
+
+  if (headless && result == 0) {
+    float seconds = (SDL_GetTicks() - start) / 1000.0f;
+    int dropped = 0;
+    for (int s = 0; s < num_strips; s++)
+      dropped += shared->strips[s].dropped_halo;
+    printf("%d frames in %.2f s (%.1f frames/s), %d particles, %d halo "
+           "particles dropped\n",
+           frame, seconds, seconds > 0 ? frame / seconds : 0.0f,
+           state.particle_count, dropped);
+  } else if (!headless) {
+    cleanup();
+  }
+
+  unmap_shared(num_strips);
+  cleanup_world();
+  allocator_cleanup();
+  return result;
+}
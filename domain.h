@@ -0,0 +1,10 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+// Split the world into vertical strips, each simulated by its own worker
+// process. Renders the assembled frames, or runs headless for frame_limit
+// frames when frame_limit > 0. obstacle_path, if set, is loaded on top of the
+// scenario's obstacles in every process.
+int run_domains(int num_strips, int frame_limit, const char *obstacle_path);
+
+#endif
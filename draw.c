@@ -1,8 +1,19 @@
+#include "allocator.h"
+#include "barnes_hut.h"
+#include "brush.h"
+#include "capture.h"
+#include "constraints.h"
 #include "defs.h"
+#include "governor.h"
+#include "obstacle.h"
+#include "sph.h"
+#include "state.h"
+#include "text.h"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_rect.h>
 #include <SDL2/SDL_render.h>
 #include <math.h>
+#include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,60 +32,83 @@ void set_draw_color(Color color) {
   SDL_SetRenderDrawColor(state.renderer, color.r, color.g, color.b, 255);
 }
 
-SDL_Texture *create_circle_texture(int radius) {
-  int diameter = radius * 2;
-
-  // Create a texture with per-pixel alpha
-  SDL_Texture *texture =
-      SDL_CreateTexture(state.renderer, SDL_PIXELFORMAT_RGBA8888,
-                        SDL_TEXTUREACCESS_TARGET, diameter, diameter);
-  if (!texture) {
+// Radii pre-rasterized into the sprite atlas; particles use the closest one
+static const int sprite_radii[] = {1, 2, 3, 4, 6, 8, 12, 16};
+#define SPRITE_COUNT (int)(sizeof(sprite_radii) / sizeof(sprite_radii[0]))
+#define SPRITE_MAX_RADIUS 16
+#define SPRITE_PADDING 1 // transparent border that holds the anti-aliased edge
+
+typedef struct Sprite {
+  float u0, v0, u1, v1;
+  float extent; // quad half-size per pixel of particle radius
+} Sprite;
+
+static Sprite sprites[SPRITE_COUNT];
+static int sprite_for_radius[SPRITE_MAX_RADIUS + 1];
+
+// Rasterize one anti-aliased white disc per radius side by side into an
+// in-memory surface and upload it once. Colour comes from the vertex colours.
+SDL_Texture *create_sprite_atlas() {
+  int width = 0;
+  int height = 0;
+  for (int s = 0; s < SPRITE_COUNT; s++) {
+    int size = 2 * (sprite_radii[s] + SPRITE_PADDING);
+    width += size;
+    if (size > height)
+      height = size;
+  }
+
+  SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(
+      0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+  if (!surface) {
     return NULL;
   }
+  memset(surface->pixels, 0, surface->h * surface->pitch);
+
+  int x0 = 0;
+  for (int s = 0; s < SPRITE_COUNT; s++) {
+    int radius = sprite_radii[s];
+    int size = 2 * (radius + SPRITE_PADDING);
+    float center = size / 2.0f;
+
+    // Coverage falls off linearly across the pixel that straddles the edge
+    for (int y = 0; y < size; y++) {
+      Uint32 *row = (Uint32 *)((Uint8 *)surface->pixels + y * surface->pitch);
+      for (int x = 0; x < size; x++) {
+        float dx = x + 0.5f - center;
+        float dy = y + 0.5f - center;
+        float coverage = radius + 0.5f - sqrtf(dx * dx + dy * dy);
+        if (coverage <= 0.0f)
+          continue;
+        if (coverage > 1.0f)
+          coverage = 1.0f;
+        row[x0 + x] = (Uint32)(coverage * 255.0f + 0.5f) << 24 | 0xffffffu;
+      }
+    }
 
-  // Set blend mode for alpha blending
-  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-
-  // Set the texture as render target
-  SDL_Texture *original_target = SDL_GetRenderTarget(state.renderer);
-  SDL_SetRenderTarget(state.renderer, texture);
-
-  // Clear with transparent background
-  SDL_SetRenderDrawColor(state.renderer, 0, 0, 0, 0);
-  SDL_RenderClear(state.renderer);
-
-  // Draw white circle (color will be modulated when rendering)
-  SDL_SetRenderDrawColor(state.renderer, 255, 255, 255, 255);
+    sprites[s] = (Sprite){.u0 = (float)x0 / width,
+                          .v0 = 0.0f,
+                          .u1 = (float)(x0 + size) / width,
+                          .v1 = (float)size / height,
+                          .extent = center / radius};
+    x0 += size;
+  }
 
-  // Draw filled circle by drawing horizontal lines
-  for (int y = -radius; y < radius; y++) {
-    int width = (int)sqrt(radius * radius - y * y);
-    for (int x = -width; x < width; x++) {
-      SDL_RenderDrawPoint(state.renderer, radius + x, radius + y);
+  for (int r = 0; r <= SPRITE_MAX_RADIUS; r++) {
+    int best = 0;
+    for (int s = 1; s < SPRITE_COUNT; s++) {
+      if (abs(sprite_radii[s] - r) < abs(sprite_radii[best] - r))
+        best = s;
     }
+    sprite_for_radius[r] = best;
   }
 
-  // Restore original render target
-  SDL_SetRenderTarget(state.renderer, original_target);
-
-  return texture;
-}
-
-int init_batch_rendering() {
-  // Allocate vertex and index arrays for batched rendering
-  // Each particle needs 4 vertices (quad) and 6 indices (2 triangles)
-  state.max_vertices = MAX_SOURCE_PARTICLES * 4;
-  state.max_indices = MAX_SOURCE_PARTICLES * 6;
-
-  state.vertices = malloc(state.max_vertices * sizeof(SDL_Vertex));
-  state.indices = malloc(state.max_indices * sizeof(int));
-
-  if (!state.vertices || !state.indices) {
-    printf("Failed to allocate batch rendering arrays\n");
-    return -1;
+  SDL_Texture *texture = SDL_CreateTextureFromSurface(state.renderer, surface);
+  SDL_FreeSurface(surface);
+  if (texture) {
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
   }
-
-  return 0;
+  return texture;
 }
 
 void cleanup_batch_rendering() {
@@ -86,101 +120,54 @@ void cleanup_batch_rendering() {
     free(state.indices);
     state.indices = NULL;
   }
+  state.max_vertices = 0;
+  state.max_indices = 0;
 }
 
-SDL_Texture *create_text_texture(const char *text, SDL_Color color) {
-  if (!state.font)
-    return NULL;
-
-  SDL_Surface *surface = TTF_RenderText_Solid(state.font, text, color);
-  if (!surface)
-    return NULL;
-
-  SDL_Texture *texture = SDL_CreateTextureFromSurface(state.renderer, surface);
-  SDL_FreeSurface(surface);
-
-  return texture;
-}
-
-int init_ui_cache() {
-  SDL_Color white = {255, 255, 255, 255};
-
-  // Initialize all pointers to NULL
-  memset(&state.ui_cache, 0, sizeof(UICache));
-
-  // Create static UI textures
-  state.ui_cache.controls_label = create_text_texture("Controls:", white);
-  state.ui_cache.space_help =
-      create_text_texture("SPACE - Pause/Resume", white);
-  state.ui_cache.step_help = create_text_texture("J - Step simulation", white);
-  state.ui_cache.reset_help =
-      create_text_texture("R - Reset simulation", white);
-  state.ui_cache.vectors_help =
-      create_text_texture("V - Toggle vectors", white);
-  state.ui_cache.settings_help =
-      create_text_texture("S - Toggle settings", white);
-  state.ui_cache.quit_help = create_text_texture("Q - Quit", white);
-
-  // Initialize dynamic cache values to invalid states
-  state.ui_cache.last_fps = -1.0f;
-  state.ui_cache.last_particle_count = -1;
-  state.ui_cache.last_paused_state = -1;
+// Vertex and index arrays for batched rendering of the given number of
+// particles, replacing any previous ones
+int init_batch_rendering(int particles) {
+  cleanup_batch_rendering();
 
-  return 0;
-}
+  // Each particle needs 4 vertices (quad) and 6 indices (2 triangles)
+  state.vertices = malloc((size_t)particles * 4 * sizeof(SDL_Vertex));
+  state.indices = malloc((size_t)particles * 6 * sizeof(int));
 
-void cleanup_ui_cache() {
-  // Clean up static textures
-  if (state.ui_cache.controls_label) {
-    SDL_DestroyTexture(state.ui_cache.controls_label);
-  }
-  if (state.ui_cache.space_help) {
-    SDL_DestroyTexture(state.ui_cache.space_help);
-  }
-  if (state.ui_cache.step_help) {
-    SDL_DestroyTexture(state.ui_cache.step_help);
-  }
-  if (state.ui_cache.reset_help) {
-    SDL_DestroyTexture(state.ui_cache.reset_help);
-  }
-  if (state.ui_cache.vectors_help) {
-    SDL_DestroyTexture(state.ui_cache.vectors_help);
-  }
-  if (state.ui_cache.settings_help) {
-    SDL_DestroyTexture(state.ui_cache.settings_help);
-  }
-  if (state.ui_cache.quit_help) {
-    SDL_DestroyTexture(state.ui_cache.quit_help);
+  if (!state.vertices || !state.indices) {
+    printf("Failed to allocate batch rendering arrays\n");
+    cleanup_batch_rendering();
+    return -1;
   }
+  state.max_vertices = particles * 4;
+  state.max_indices = particles * 6;
 
-  // Clean up dynamic textures
-  if (state.ui_cache.fps_texture) {
-    SDL_DestroyTexture(state.ui_cache.fps_texture);
-  }
-  if (state.ui_cache.particles_texture) {
-    SDL_DestroyTexture(state.ui_cache.particles_texture);
-  }
-  if (state.ui_cache.status_texture) {
-    SDL_DestroyTexture(state.ui_cache.status_texture);
-  }
+  // Place each particle's vertices with the thread that builds them
+  allocator_first_touch(state.vertices, 4 * sizeof(SDL_Vertex), particles,
+                        PARTICLE_CHUNK);
+  allocator_first_touch(state.indices, 6 * sizeof(int), particles,
+                        PARTICLE_CHUNK);
 
-  // Clear the cache
-  memset(&state.ui_cache, 0, sizeof(UICache));
+  return 0;
 }
 
 void add_particle_to_batch(Circle *c, int particle_idx) {
-  if (particle_idx >= MAX_SOURCE_PARTICLES)
+  if (particle_idx >= state.max_vertices / 4)
     return;
 
-  int radius = (int)c->radius;
+  // Pick the closest pre-rasterized radius and scale it to the particle
+  int radius = (int)(c->radius + 0.5f);
+  if (radius > SPRITE_MAX_RADIUS)
+    radius = SPRITE_MAX_RADIUS;
+  const Sprite *sprite = &sprites[sprite_for_radius[radius]];
+  float half_size = c->radius * sprite->extent;
   float center_x = c->xcenter;
   float center_y = c->ycenter;
 
   // Calculate quad vertices
-  float left = center_x - radius;
-  float right = center_x + radius;
-  float top = center_y - radius;
-  float bottom = center_y + radius;
+  float left = center_x - half_size;
+  float right = center_x + half_size;
+  float top = center_y - half_size;
+  float bottom = center_y + half_size;
 
   int vertex_offset = particle_idx * 4;
   int index_offset = particle_idx * 6;
@@ -189,8 +176,8 @@ void add_particle_to_batch(Circle *c, int particle_idx) {
   // Top-left
   state.vertices[vertex_offset + 0].position.x = left;
   state.vertices[vertex_offset + 0].position.y = top;
-  state.vertices[vertex_offset + 0].tex_coord.x = 0.0f;
-  state.vertices[vertex_offset + 0].tex_coord.y = 0.0f;
+  state.vertices[vertex_offset + 0].tex_coord.x = sprite->u0;
+  state.vertices[vertex_offset + 0].tex_coord.y = sprite->v0;
   state.vertices[vertex_offset + 0].color.r = c->color.r;
   state.vertices[vertex_offset + 0].color.g = c->color.g;
   state.vertices[vertex_offset + 0].color.b = c->color.b;
@@ -199,8 +186,8 @@ void add_particle_to_batch(Circle *c, int particle_idx) {
   // Top-right
   state.vertices[vertex_offset + 1].position.x = right;
   state.vertices[vertex_offset + 1].position.y = top;
-  state.vertices[vertex_offset + 1].tex_coord.x = 1.0f;
-  state.vertices[vertex_offset + 1].tex_coord.y = 0.0f;
+  state.vertices[vertex_offset + 1].tex_coord.x = sprite->u1;
+  state.vertices[vertex_offset + 1].tex_coord.y = sprite->v0;
   state.vertices[vertex_offset + 1].color.r = c->color.r;
   state.vertices[vertex_offset + 1].color.g = c->color.g;
   state.vertices[vertex_offset + 1].color.b = c->color.b;
@@ -209,8 +196,8 @@ void add_particle_to_batch(Circle *c, int particle_idx) {
   // Bottom-left
   state.vertices[vertex_offset + 2].position.x = left;
   state.vertices[vertex_offset + 2].position.y = bottom;
-  state.vertices[vertex_offset + 2].tex_coord.x = 0.0f;
-  state.vertices[vertex_offset + 2].tex_coord.y = 1.0f;
+  state.vertices[vertex_offset + 2].tex_coord.x = sprite->u0;
+  state.vertices[vertex_offset + 2].tex_coord.y = sprite->v1;
   state.vertices[vertex_offset + 2].color.r = c->color.r;
   state.vertices[vertex_offset + 2].color.g = c->color.g;
   state.vertices[vertex_offset + 2].color.b = c->color.b;
@@ -219,8 +206,8 @@ void add_particle_to_batch(Circle *c, int particle_idx) {
   // Bottom-right
   state.vertices[vertex_offset + 3].position.x = right;
   state.vertices[vertex_offset + 3].position.y = bottom;
-  state.vertices[vertex_offset + 3].tex_coord.x = 1.0f;
-  state.vertices[vertex_offset + 3].tex_coord.y = 1.0f;
+  state.vertices[vertex_offset + 3].tex_coord.x = sprite->u1;
+  state.vertices[vertex_offset + 3].tex_coord.y = sprite->v1;
   state.vertices[vertex_offset + 3].color.r = c->color.r;
   state.vertices[vertex_offset + 3].color.g = c->color.g;
   state.vertices[vertex_offset + 3].color.b = c->color.b;
@@ -237,23 +224,308 @@ void add_particle_to_batch(Circle *c, int particle_idx) {
 }
 
 void render_particles_batched() {
-  if (!state.circle_texture || !state.vertices || !state.indices ||
+  // The arrays start at the default emitter's size and grow to the particle
+  // pool the first time a larger scene is drawn
+  if (state.particle_count > state.max_vertices / 4 &&
+      init_batch_rendering(allocator_capacity()) < 0) {
+    return;
+  }
+  if (!state.sprite_atlas || !state.vertices || !state.indices ||
       state.particle_count == 0) {
     return;
   }
 
+  int count = state.particle_count;
+  if (count > state.max_vertices / 4)
+    count = state.max_vertices / 4;
+
   // Build vertex array for all particles
-  for (int i = 0; i < state.particle_count; i++) {
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+  for (int i = 0; i < count; i++) {
     add_particle_to_batch(&state.particles[i], i);
   }
 
   // Render all particles in one call
-  SDL_RenderGeometry(state.renderer, state.circle_texture, state.vertices,
-                     state.particle_count * 4, state.indices,
-                     state.particle_count * 6);
+  SDL_RenderGeometry(state.renderer, state.sprite_atlas, state.vertices,
+                     count * 4, state.indices, count * 6);
 }
 
 
+// Write one particle's disc into the rows [row_begin, row_end) of the splat
+// texture as a hard-edged disc
+static void splat_particle(const Circle *c, Uint8 *pixels, int pitch,
+                           int row_begin, int row_end) {
+  int radius = (int)c->radius;
+  int center_x = (int)floorf(c->xcenter);
+  int center_y = (int)floorf(c->ycenter);
+  if (center_y + radius <= row_begin || center_y - radius >= row_end)
+    return;
+
+  Uint32 color = 0xff000000u | (Uint32)c->color.r << 16 |
+                 (Uint32)c->color.g << 8 | (Uint32)c->color.b;
+
+  for (int y = -radius; y < radius; y++) {
+    int row = center_y + y;
+    if (row < row_begin || row >= row_end)
+      continue;
+
+    Uint32 *pixel_row = (Uint32 *)(pixels + row * pitch);
+    int width = (int)sqrt(radius * radius - y * y);
+    for (int x = -width; x < width; x++) {
+      int column = center_x + x;
+      if (column >= 0 && column < SCREEN_WIDTH)
+        pixel_row[column] = color;
+    }
+  }
+}
+
+// Binning buffers for the splat path, kept between frames (rendering also
+// runs while paused, when the frame arena is not reset)
+static int *splat_counts; // per thread and band, then write positions
+static int splat_counts_capacity;
+static int *splat_bins; // particle indices, grouped by band
+static int splat_bins_capacity;
+
+static int *grow_splat_buffer(int *buffer, int *capacity, int needed) {
+  if (needed <= *capacity)
+    return buffer;
+
+  int new_capacity = needed + needed / 2;
+  allocator_free_buffer(buffer);
+  buffer = allocator_alloc_buffer((size_t)new_capacity * sizeof(int));
+  if (!buffer) {
+    printf("Failed to allocate splat bins\n");
+    exit(1);
+  }
+  *capacity = new_capacity;
+  return buffer;
+}
+
+static int band_begin(int band, int bands) {
+  return SCREEN_HEIGHT * band / bands;
+}
+
+// Bands of rows a particle's disc touches, or 0 if it misses the texture
+static int splat_bands(const Circle *c, int bands, int *first, int *last) {
+  int radius = (int)c->radius;
+  int center_x = (int)floorf(c->xcenter);
+  int center_y = (int)floorf(c->ycenter);
+  int top = center_y - radius;
+  int bottom = center_y + radius - 1;
+  if (bottom < 0 || top >= SCREEN_HEIGHT || center_x + radius <= 0 ||
+      center_x - radius >= SCREEN_WIDTH)
+    return 0;
+
+  top = top < 0 ? 0 : top;
+  bottom = bottom >= SCREEN_HEIGHT ? SCREEN_HEIGHT - 1 : bottom;
+  *first = top * bands / SCREEN_HEIGHT;
+  while (*first + 1 < bands && band_begin(*first + 1, bands) <= top)
+    (*first)++;
+  *last = bottom * bands / SCREEN_HEIGHT;
+  while (*last + 1 < bands && band_begin(*last + 1, bands) <= bottom)
+    (*last)++;
+  return 1;
+}
+
+// Splat all particles into the streaming texture, locked once per frame, and
+// draw it with a single copy. Each thread clears and fills its own band of
+// rows, so threads never write the same pixel. Particles are binned by band
+// first, with a count and a scatter pass split across the threads, so a band
+// only visits the particles that touch it.
+void render_particles_splatted() {
+  void *pixels;
+  int pitch;
+  if (SDL_LockTexture(state.splat_texture, NULL, &pixels, &pitch) < 0) {
+    render_particles_batched();
+    return;
+  }
+
+  // Thread and band counts, then the start of every band
+  int max_bands = omp_get_max_threads();
+  splat_counts = grow_splat_buffer(splat_counts, &splat_counts_capacity,
+                                   max_bands * (max_bands + 1) + 1);
+  int *cursors = splat_counts;
+  int *band_start = splat_counts + max_bands * max_bands;
+
+#pragma omp parallel
+  {
+    int bands = omp_get_num_threads();
+    int thread = omp_get_thread_num();
+    int *own = &cursors[thread * bands];
+    int first, last;
+
+    for (int b = 0; b < bands; b++)
+      own[b] = 0;
+#pragma omp for schedule(static)
+    for (int i = 0; i < state.particle_count; i++) {
+      if (splat_bands(&state.particles[i], bands, &first, &last)) {
+        for (int b = first; b <= last; b++)
+          own[b]++;
+      }
+    }
+
+    // Band-major offsets, each thread's share of a band in thread order
+#pragma omp single
+    {
+      int total = 0;
+      for (int b = 0; b < bands; b++) {
+        band_start[b] = total;
+        for (int t = 0; t < bands; t++) {
+          int count = cursors[t * bands + b];
+          cursors[t * bands + b] = total;
+          total += count;
+        }
+      }
+      band_start[bands] = total;
+      splat_bins = grow_splat_buffer(splat_bins, &splat_bins_capacity, total);
+    }
+
+    // The same static schedule hands each thread the particles it counted
+#pragma omp for schedule(static)
+    for (int i = 0; i < state.particle_count; i++) {
+      if (splat_bands(&state.particles[i], bands, &first, &last)) {
+        for (int b = first; b <= last; b++)
+          splat_bins[own[b]++] = i;
+      }
+    }
+
+    int row_begin = band_begin(thread, bands);
+    int row_end = band_begin(thread + 1, bands);
+    memset((Uint8 *)pixels + row_begin * pitch, 0,
+           (size_t)(row_end - row_begin) * pitch);
+    for (int k = band_start[thread]; k < band_start[thread + 1]; k++) {
+      splat_particle(&state.particles[splat_bins[k]], pixels, pitch,
+                     row_begin, row_end);
+    }
+  }
+
+  SDL_UnlockTexture(state.splat_texture);
+  SDL_RenderCopy(state.renderer, state.splat_texture, NULL, NULL);
+}
+
+// Blue through cyan and yellow to red for t in [0, 1]
+static Uint32 heat_color(float t) {
+  if (t > 1.0f)
+    t = 1.0f;
+
+  float r, g, b;
+  if (t < 1.0f / 3.0f) {
+    r = 0.0f;
+    g = 3.0f * t;
+    b = 1.0f;
+  } else if (t < 2.0f / 3.0f) {
+    r = 3.0f * t - 1.0f;
+    g = 1.0f;
+    b = 2.0f - 3.0f * t;
+  } else {
+    r = 1.0f;
+    g = 3.0f - 3.0f * t;
+    b = 0.0f;
+  }
+
+  return 0xff000000u | (Uint32)(r * 255.0f) << 16 |
+         (Uint32)(g * 255.0f) << 8 | (Uint32)(b * 255.0f);
+}
+
+// Draw the grid as a density or speed field: one pixel per cell, uploaded
+// through a streaming texture and stretched over the world, so the cost
+// depends on the number of cells rather than particles. Empty cells stay
+// transparent.
+void render_heat_map() {
+  static int texture_width, texture_height;
+
+  if (!state.heat_texture || texture_width != state.grid_width ||
+      texture_height != state.grid_height) {
+    if (state.heat_texture)
+      SDL_DestroyTexture(state.heat_texture);
+    state.heat_texture = SDL_CreateTexture(
+        state.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+        state.grid_width, state.grid_height);
+    if (!state.heat_texture)
+      return;
+    SDL_SetTextureBlendMode(state.heat_texture, SDL_BLENDMODE_BLEND);
+    texture_width = state.grid_width;
+    texture_height = state.grid_height;
+  }
+
+  void *pixels;
+  int pitch;
+  if (SDL_LockTexture(state.heat_texture, NULL, &pixels, &pitch) < 0)
+    return;
+
+  int speed = state.settings.render_mode == RENDER_SPEED;
+#pragma omp parallel for schedule(static)
+  for (int y = 0; y < state.grid_height; y++) {
+    Uint32 *row = (Uint32 *)((Uint8 *)pixels + y * pitch);
+    for (int x = 0; x < state.grid_width; x++) {
+      GridCell *cell = &state.grid[y * state.grid_width + x];
+      if (cell->count == 0) {
+        row[x] = 0;
+      } else if (speed) {
+        float mean_x = cell->velocity_x_sum / cell->count;
+        float mean_y = cell->velocity_y_sum / cell->count;
+        row[x] = heat_color(sqrtf(mean_x * mean_x + mean_y * mean_y) /
+                            HEAT_SPEED_SCALE);
+      } else {
+        row[x] = heat_color(cell->count / HEAT_DENSITY_SCALE);
+      }
+    }
+  }
+
+  SDL_UnlockTexture(state.heat_texture);
+
+  SDL_Rect world = {0, 0, state.grid_width * GRID_CELL_SIZE,
+                    state.grid_height * GRID_CELL_SIZE};
+  SDL_RenderCopy(state.renderer, state.heat_texture, NULL, &world);
+}
+
+// Obstacle coverage from the distance field, anti-aliased across the pixel
+// that straddles the surface and rasterized once per obstacle map
+static SDL_Texture *create_obstacle_texture() {
+  SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(
+      0, state.world_width, state.world_height, 32, SDL_PIXELFORMAT_ARGB8888);
+  if (!surface) {
+    return NULL;
+  }
+
+#pragma omp parallel for schedule(static)
+  for (int y = 0; y < surface->h; y++) {
+    Uint32 *row = (Uint32 *)((Uint8 *)surface->pixels + y * surface->pitch);
+    for (int x = 0; x < surface->w; x++) {
+      float grad_x, grad_y;
+      float coverage =
+          0.5f - obstacle_distance(x + 0.5f, y + 0.5f, &grad_x, &grad_y);
+      coverage = fminf(fmaxf(coverage, 0.0f), 1.0f);
+      row[x] = (Uint32)(coverage * 255.0f + 0.5f) << 24 | 0x505050u;
+    }
+  }
+
+  SDL_Texture *texture = SDL_CreateTextureFromSurface(state.renderer, surface);
+  SDL_FreeSurface(surface);
+  if (texture) {
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  }
+  return texture;
+}
+
+void render_obstacles() {
+  static const float *rasterized;
+
+  if (!state.obstacles.distance)
+    return;
+  if (!state.obstacle_texture || rasterized != state.obstacles.distance) {
+    if (state.obstacle_texture)
+      SDL_DestroyTexture(state.obstacle_texture);
+    state.obstacle_texture = create_obstacle_texture();
+    if (!state.obstacle_texture)
+      return;
+    rasterized = state.obstacles.distance;
+  }
+
+  SDL_Rect world = {0, 0, state.world_width, state.world_height};
+  SDL_RenderCopy(state.renderer, state.obstacle_texture, NULL, &world);
+}
+
 void draw_velocity_vector(Circle *c) {
   // Skip if velocity is zero to avoid drawing zero-length vectors
   if (c->xvelocity == 0.0f && c->yvelocity == 0.0f) {
@@ -277,17 +549,38 @@ void draw_velocity_vector(Circle *c) {
 }
 
 
+static SDL_Surface *headless_surface; // target of the headless renderer
+
 void cleanup() {
-  // Cleanup UI cache
-  cleanup_ui_cache();
+  // Cleanup glyph atlas and text buffers
+  cleanup_text();
 
   // Cleanup batch rendering
   cleanup_batch_rendering();
 
-  // Destroy circle texture
-  if (state.circle_texture) {
-    SDL_DestroyTexture(state.circle_texture);
-    state.circle_texture = NULL;
+  // Destroy sprite atlas
+  if (state.sprite_atlas) {
+    SDL_DestroyTexture(state.sprite_atlas);
+    state.sprite_atlas = NULL;
+  }
+
+  if (state.splat_texture) {
+    SDL_DestroyTexture(state.splat_texture);
+    state.splat_texture = NULL;
+  }
+  allocator_free_buffer(splat_counts);
+  allocator_free_buffer(splat_bins);
+  splat_counts = splat_bins = NULL;
+  splat_counts_capacity = splat_bins_capacity = 0;
+
+  if (state.heat_texture) {
+    SDL_DestroyTexture(state.heat_texture);
+    state.heat_texture = NULL;
+  }
+
+  if (state.obstacle_texture) {
+    SDL_DestroyTexture(state.obstacle_texture);
+    state.obstacle_texture = NULL;
   }
 
   // Close font
@@ -296,9 +589,15 @@ void cleanup() {
     state.font = NULL;
   }
 
-  // Destroy renderer and window
+  // Destroy renderer and window, or the surface of a headless run
   SDL_DestroyRenderer(state.renderer);
-  SDL_DestroyWindow(state.window);
+  if (state.window) {
+    SDL_DestroyWindow(state.window);
+  }
+  if (headless_surface) {
+    SDL_FreeSurface(headless_surface);
+    headless_surface = NULL;
+  }
 
   // Quit SDL subsystems
   TTF_Quit();
@@ -315,16 +614,16 @@ void present() { SDL_RenderPresent(state.renderer); }
 
 void draw_borders() {
   SDL_Rect borders[4];
-  SDL_Rect top = {.x = 0, .y = 0, .w = SCREEN_WIDTH, .h = BORDER_WIDTH};
-  SDL_Rect right = {.y = 0,
-                    .x = SCREEN_WIDTH - BORDER_WIDTH,
-                    .w = BORDER_WIDTH,
-                    .h = SCREEN_HEIGHT};
-  SDL_Rect bottom = {.x = 0,
-                     .y = SCREEN_HEIGHT - BORDER_WIDTH,
-                     .w = SCREEN_WIDTH,
-                     .h = BORDER_WIDTH};
-  SDL_Rect left = {.x = 0, .y = 0, .w = BORDER_WIDTH, .h = SCREEN_HEIGHT};
+  // The walls of the world, which a scenario may make smaller or larger
+  // than the window
+  int width = state.world_width;
+  int height = state.world_height;
+  SDL_Rect top = {.x = 0, .y = 0, .w = width, .h = BORDER_WIDTH};
+  SDL_Rect right = {
+      .y = 0, .x = width - BORDER_WIDTH, .w = BORDER_WIDTH, .h = height};
+  SDL_Rect bottom = {
+      .x = 0, .y = height - BORDER_WIDTH, .w = width, .h = BORDER_WIDTH};
+  SDL_Rect left = {.x = 0, .y = 0, .w = BORDER_WIDTH, .h = height};
 
   borders[0] = top;
   borders[1] = right;
@@ -335,44 +634,8 @@ void draw_borders() {
   SDL_RenderFillRects(state.renderer, borders, 4);
 }
 
-int setup() {
-  // Initialize SDL
-  if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-    printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
-    return 1;
-  }
-
-  // Initialize SDL_ttf
-  if (TTF_Init() < 0) {
-    printf("Could not initialize SDL_ttf: %s\n", TTF_GetError());
-    return 1;
-  }
-
-  // Create window
-  SDL_Window *window = SDL_CreateWindow(
-      "Simple particle engine", SDL_WINDOWPOS_UNDEFINED,
-      SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
-  if (window == NULL) {
-    printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
-    SDL_Quit();
-    return 1;
-  }
-
-  state.window = window;
-
-  // Create renderer
-  SDL_Renderer *renderer =
-      SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-  if (renderer == NULL) {
-    printf("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
-    SDL_DestroyWindow(window);
-    SDL_Quit();
-    return 1;
-  }
-
-  clear_screen();
-  state.renderer = renderer;
-
+// Font, textures and buffers on top of the renderer
+static int setup_resources() {
   // Load font (try common system font paths)
   state.font =
       TTF_OpenFont("/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf", 16);
@@ -390,76 +653,109 @@ int setup() {
   state.particles = NULL;
   state.particle_count = 0;
 
-  // Create circle texture (using average particle radius)
-  int default_radius = 2; // Matches typical particle size
-  state.circle_texture = create_circle_texture(default_radius);
-  state.circle_texture_size = default_radius * 2;
-  if (!state.circle_texture) {
-    printf("Warning: Could not create circle texture\n");
+  // Create the sprite atlas with all particle radii
+  state.sprite_atlas = create_sprite_atlas();
+  if (!state.sprite_atlas) {
+    printf("Warning: Could not create sprite atlas\n");
+  }
+
+  // Create the streaming texture for splatting large scenes
+  state.splat_texture = SDL_CreateTexture(
+      state.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+      SCREEN_WIDTH, SCREEN_HEIGHT);
+  if (state.splat_texture) {
+    SDL_SetTextureBlendMode(state.splat_texture, SDL_BLENDMODE_BLEND);
+  } else {
+    printf("Warning: Could not create splat texture\n");
   }
 
   // Initialize batch rendering
-  if (init_batch_rendering() < 0) {
+  if (init_batch_rendering(MAX_SOURCE_PARTICLES) < 0) {
     printf("Warning: Could not initialize batch rendering\n");
   }
 
-  // Initialize UI cache
-  if (init_ui_cache() < 0) {
-    printf("Warning: Could not initialize UI cache\n");
+  // Build the glyph atlas for the settings panel
+  if (init_text() < 0) {
+    printf("Warning: Could not initialize text rendering\n");
   }
 
   return 0;
 }
 
+// Software renderer drawing into a screen-sized surface, no window needed
+static SDL_Renderer *create_headless_renderer() {
+  headless_surface = SDL_CreateRGBSurfaceWithFormat(
+      0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+  if (!headless_surface) {
+    printf("Surface could not be created! SDL_Error: %s\n", SDL_GetError());
+    return NULL;
+  }
+  SDL_Renderer *renderer = SDL_CreateSoftwareRenderer(headless_surface);
+  if (renderer == NULL) {
+    printf("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
+    SDL_FreeSurface(headless_surface);
+    headless_surface = NULL;
+  }
+  return renderer;
+}
+
+int setup(int headless) {
+  // Initialize SDL, headless runs need no video device
+  if (SDL_Init(headless ? 0 : SDL_INIT_VIDEO) < 0) {
+    printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
+    return 1;
+  }
 
-void update_dynamic_ui_textures() {
-  SDL_Color white = {255, 255, 255, 255};
-  char text[128];
+  // Initialize SDL_ttf
+  if (TTF_Init() < 0) {
+    printf("Could not initialize SDL_ttf: %s\n", TTF_GetError());
+    return 1;
+  }
 
-  // Update FPS texture if changed
-  if (state.fps != state.ui_cache.last_fps) {
-    if (state.ui_cache.fps_texture) {
-      SDL_DestroyTexture(state.ui_cache.fps_texture);
+  if (headless) {
+    state.renderer = create_headless_renderer();
+    if (state.renderer == NULL) {
+      SDL_Quit();
+      return 1;
     }
-    snprintf(text, sizeof(text), "FPS: %.0f", state.fps);
-    state.ui_cache.fps_texture = create_text_texture(text, white);
-    state.ui_cache.last_fps = state.fps;
+    return setup_resources();
   }
 
-  // Update particle count texture if changed
-  if (state.source.particles_spawned != state.ui_cache.last_particle_count) {
-    if (state.ui_cache.particles_texture) {
-      SDL_DestroyTexture(state.ui_cache.particles_texture);
-    }
-    snprintf(text, sizeof(text), "Particles: %d",
-             state.source.particles_spawned);
-    state.ui_cache.particles_texture = create_text_texture(text, white);
-    state.ui_cache.last_particle_count = state.source.particles_spawned;
+  // Create window
+  SDL_Window *window = SDL_CreateWindow(
+      "Simple particle engine", SDL_WINDOWPOS_UNDEFINED,
+      SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+  if (window == NULL) {
+    printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
+    SDL_Quit();
+    return 1;
   }
 
-  // Update status texture if changed
-  int current_paused = state.settings.is_paused ? 1 : 0;
-  if (current_paused != state.ui_cache.last_paused_state) {
-    if (state.ui_cache.status_texture) {
-      SDL_DestroyTexture(state.ui_cache.status_texture);
-    }
-    const char *status_text = state.settings.is_paused ? "PAUSED" : "RUNNING";
-    snprintf(text, sizeof(text), "Status: %s", status_text);
-    state.ui_cache.status_texture = create_text_texture(text, white);
-    state.ui_cache.last_paused_state = current_paused;
+  state.window = window;
+
+  // Create renderer, falling back to the software renderer when there is no
+  // GPU (e.g. headless runs with SDL_VIDEODRIVER=dummy)
+  SDL_Renderer *renderer =
+      SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+  if (renderer == NULL) {
+    printf("Accelerated renderer unavailable, using software: %s\n",
+           SDL_GetError());
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+  }
+  if (renderer == NULL) {
+    printf("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 1;
   }
-}
 
-void draw_cached_texture(SDL_Texture *texture, int x, int y) {
-  if (!texture)
-    return;
+  clear_screen();
+  state.renderer = renderer;
 
-  int w, h;
-  SDL_QueryTexture(texture, NULL, NULL, &w, &h);
-  SDL_Rect rect = {x, y, w, h};
-  SDL_RenderCopy(state.renderer, texture, NULL, &rect);
+  return setup_resources();
 }
 
+
 void draw_settings_panel() {
   if (!state.settings.show_settings || !state.font)
     return;
@@ -467,57 +763,123 @@ void draw_settings_panel() {
   // Calculate panel position
   int panel_x = SCREEN_WIDTH - SETTINGS_PANEL_WIDTH;
   int panel_y = 10;
-  int y_offset = panel_y + 20;
-  int line_height = 25;
+  int y_offset = panel_y + 10;
+  int line_height = text_line_height() + 2;
   int text_x = panel_x + 10;
 
-  // Update dynamic textures only when values change
-  update_dynamic_ui_textures();
-
-  // Draw dynamic content using cached textures
-  draw_cached_texture(state.ui_cache.fps_texture, text_x, y_offset);
+  // Live metrics, formatted every frame: each line is only a few quads
+  draw_text(text_x, y_offset, "FPS: %.0f", state.fps);
   y_offset += line_height;
-
-  draw_cached_texture(state.ui_cache.particles_texture, text_x, y_offset);
-  y_offset += line_height * 2;
-
-  draw_cached_texture(state.ui_cache.status_texture, text_x, y_offset);
-  y_offset += line_height * 2;
-
-  // Draw static content using cached textures
-  draw_cached_texture(state.ui_cache.controls_label, text_x, y_offset);
+  draw_text(text_x, y_offset, "Particles: %d", state.source.particles_spawned);
   y_offset += line_height;
-
-  draw_cached_texture(state.ui_cache.space_help, text_x, y_offset);
+  draw_text(text_x, y_offset, "Status: %s",
+            state.settings.is_paused ? "PAUSED" : "RUNNING");
   y_offset += line_height;
-
-  draw_cached_texture(state.ui_cache.step_help, text_x, y_offset);
+  if (state.settings.frame_budget_ms > 0.0f) {
+    draw_text(text_x, y_offset, "Quality: %s (%.1f ms)",
+              quality_level_name(state.settings.quality_level),
+              state.settings.frame_budget_ms);
+  } else {
+    draw_text(text_x, y_offset, "Quality: full (fixed)");
+  }
   y_offset += line_height;
-
-  draw_cached_texture(state.ui_cache.reset_help, text_x, y_offset);
+  draw_text(text_x, y_offset, "Model: %s",
+            physics_model_name(state.settings.model));
   y_offset += line_height;
-
-  draw_cached_texture(state.ui_cache.vectors_help, text_x, y_offset);
+  draw_text(text_x, y_offset, "Long range: %s",
+            long_range_force_name(state.settings.long_range));
   y_offset += line_height;
-
-  draw_cached_texture(state.ui_cache.settings_help, text_x, y_offset);
+  draw_text(text_x, y_offset, "Broad phase: %s",
+            broad_phase_name(state.settings.broad_phase));
+  y_offset += line_height;
+  draw_text(text_x, y_offset, "Brush: %s", brush_tool_name(state.brush.tool));
+  y_offset += line_height;
+  draw_text(text_x, y_offset, "Integrate: %.2f ms",
+            state.timings.integrate_ms);
+  y_offset += line_height;
+  draw_text(text_x, y_offset, "Grid: %.2f ms", state.timings.grid_ms);
+  y_offset += line_height;
+  draw_text(text_x, y_offset, "Collide: %.2f ms", state.timings.collide_ms);
+  y_offset += line_height;
+  if (constraint_count() > 0) {
+    draw_text(text_x, y_offset, "Constraints: %d (%.2f ms)",
+              constraint_count(), state.timings.constraint_ms);
+    y_offset += line_height;
+  }
+  if (state.settings.diagnostics) {
+    const Diagnostics *d = &state.diagnostics;
+    draw_text(text_x, y_offset, "Energy: %.4g (kin %.3g)",
+              d->kinetic_energy + d->potential_energy, d->kinetic_energy);
+    y_offset += line_height;
+    draw_text(text_x, y_offset, "Momentum: %.3g, %.3g", d->momentum_x,
+              d->momentum_y);
+    y_offset += line_height;
+    draw_text(text_x, y_offset, "Overlap: %.2f px, overflow %d",
+              d->max_penetration, d->grid_overflow);
+    y_offset += line_height;
+  }
+
+  FrameArenaStats arena;
+  frame_arena_stats(&arena);
+  draw_text(text_x, y_offset, "Frame arena: %zu KB", arena.high_water / 1024);
+  y_offset += line_height;
+  if (state.settings.deterministic) {
+    draw_text(text_x, y_offset, "Hash: %016llx",
+              (unsigned long long)state.state_hash);
+    y_offset += line_height;
+  }
   y_offset += line_height;
 
-  draw_cached_texture(state.ui_cache.quit_help, text_x, y_offset);
+  // Controls
+  static const char *controls[] = {
+      "Controls:",
+      "SPACE - Pause/Resume",
+      "J - Step simulation",
+      "R - Reset simulation",
+      "V - Toggle vectors",
+      "S - Toggle settings",
+      "D - Deterministic mode",
+      "B - Cycle broad phase",
+      "A - Adaptive quality",
+      "F - Toggle fluid (SPH)",
+      "C - Drop soft body",
+      "E - Toggle diagnostics",
+      "G - Cycle long-range force",
+      "H - Cycle heat map",
+      "Mouse - Brush, 1/2/3 tool",
+      "Q - Quit",
+  };
+  for (size_t i = 0; i < sizeof(controls) / sizeof(controls[0]); i++) {
+    draw_text(text_x, y_offset, "%s", controls[i]);
+    y_offset += line_height;
+  }
+
+  // All panel text goes out in one geometry call
+  flush_text();
 }
 
 void render() {
-  // Render all particles in a single batched call
-  render_particles_batched();
-
-  // Render velocity vectors if enabled
-  if (state.settings.show_velocity_vectors) {
+  // Large scenes are splatted, small ones drawn in a single batched call
+  if (state.settings.render_mode != RENDER_PARTICLES) {
+    render_heat_map();
+  } else if (state.splat_texture && state.settings.splat_threshold >= 0 &&
+      state.particle_count >= state.settings.splat_threshold) {
+    render_particles_splatted();
+  } else {
+    render_particles_batched();
+  }
+
+  // Render velocity vectors if enabled and the frame budget allows it
+  if (state.settings.show_velocity_vectors &&
+      state.settings.quality_level < QUALITY_NO_VECTORS) {
     for (int i = 0; i < state.particle_count; i++) {
       draw_velocity_vector(&state.particles[i]);
     }
   }
 
+  render_obstacles();
   draw_borders();
   draw_settings_panel();
+  capture_frame();
   present();
 }
@@ -11,7 +11,7 @@ typedef struct Color {
 
 extern Color Color_CIRCLE;
 
-int setup();
+int setup(int headless);
 void render();
 void set_draw_color(Color color);
 void cleanup();
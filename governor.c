@@ -0,0 +1,78 @@
+#include "defs.h"
+#include "governor.h"
+
+extern State state;
+
+static double average_frame_ms;
+static int cooldown;
+static long frame_index;
+
+const char *quality_level_name(QualityLevel level) {
+  switch (level) {
+  case QUALITY_NO_VECTORS:
+    return "no vectors";
+  case QUALITY_THROTTLED:
+    return "throttled";
+  case QUALITY_DECIMATED:
+    return "decimated";
+  default:
+    return "full";
+  }
+}
+
+void reset_governor() {
+  state.settings.quality_level = QUALITY_FULL;
+  average_frame_ms = 0.0;
+  cooldown = GOVERNOR_COOLDOWN_FRAMES;
+}
+
+// Called once per simulated frame with the time the last render took, 0 when
+// the last frame was not rendered. The frame time is the sum of the physics
+// phases and the render, smoothed so a single hitch does not change the
+// level.
+void update_governor(double render_ms) {
+  frame_index++;
+
+  // Deterministic runs must not depend on how fast the machine is
+  if (state.settings.frame_budget_ms <= 0.0f || state.settings.deterministic) {
+    state.settings.quality_level = QUALITY_FULL;
+    return;
+  }
+
+  double frame_ms = state.timings.integrate_ms + state.timings.grid_ms +
+                    state.timings.collide_ms + state.timings.constraint_ms +
+                    render_ms;
+  if (average_frame_ms <= 0.0) {
+    average_frame_ms = frame_ms;
+  } else {
+    average_frame_ms += GOVERNOR_SMOOTHING * (frame_ms - average_frame_ms);
+  }
+
+  if (cooldown > 0) {
+    cooldown--;
+    return;
+  }
+
+  QualityLevel level = state.settings.quality_level;
+  if (average_frame_ms > state.settings.frame_budget_ms &&
+      level < QUALITY_LEVEL_COUNT - 1) {
+    state.settings.quality_level = level + 1;
+    cooldown = GOVERNOR_COOLDOWN_FRAMES;
+  } else if (average_frame_ms <
+                 state.settings.frame_budget_ms * GOVERNOR_HEADROOM &&
+             level > QUALITY_FULL) {
+    state.settings.quality_level = level - 1;
+    cooldown = GOVERNOR_COOLDOWN_FRAMES;
+  }
+}
+
+int governor_render_this_frame() {
+  return state.settings.quality_level < QUALITY_DECIMATED ||
+         frame_index % 2 == 0;
+}
+
+float governor_spawn_interval_scale() {
+  return state.settings.quality_level >= QUALITY_THROTTLED
+             ? GOVERNOR_EMISSION_THROTTLE
+             : 1.0f;
+}
@@ -0,0 +1,12 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include "defs.h"
+
+void reset_governor();
+void update_governor(double render_ms);
+int governor_render_this_frame();
+float governor_spawn_interval_scale();
+const char *quality_level_name(QualityLevel level);
+
+#endif
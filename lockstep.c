@@ -0,0 +1,139 @@
+#include <inttypes.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "defs.h"
+#include "lockstep.h"
+#include "state.h"
+
+extern State state;
+
+// Run the deterministic simulation headlessly for the given number of frames
+// and record the state hash after every step
+static void run_frames(int threads, int frames, uint64_t *hashes) {
+  omp_set_num_threads(threads);
+  reset_state();
+  init_state();
+
+  for (int f = 0; f < frames; f++) {
+    update_particle_source();
+    update_state();
+    hashes[f] = state.state_hash;
+  }
+}
+
+static int compare_hashes(const uint64_t *expected, const uint64_t *actual,
+                          int frames, const char *label) {
+  for (int f = 0; f < frames; f++) {
+    if (expected[f] != actual[f]) {
+      printf("%s: MISMATCH at frame %d (expected %016" PRIx64
+             ", got %016" PRIx64 ")\n",
+             label, f, expected[f], actual[f]);
+      return 1;
+    }
+  }
+  printf("%s: OK\n", label);
+  return 0;
+}
+
+static int write_golden(const char *path, const uint64_t *hashes, int frames) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    printf("Could not open golden file %s for writing\n", path);
+    return -1;
+  }
+  fprintf(file, "# seed %u frames %d\n", state.settings.seed, frames);
+  for (int f = 0; f < frames; f++) {
+    fprintf(file, "%d %016" PRIx64 "\n", f, hashes[f]);
+  }
+  fclose(file);
+  printf("Recorded %d frame hashes to %s\n", frames, path);
+  return 0;
+}
+
+static int read_golden(const char *path, uint64_t *hashes, int frames) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    printf("Could not open golden file %s\n", path);
+    return -1;
+  }
+
+  char line[128];
+  int count = 0;
+  while (count < frames && fgets(line, sizeof(line), file)) {
+    int frame;
+    uint64_t hash;
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "%d %" SCNx64, &frame, &hash) != 2 || frame != count) {
+      printf("Malformed golden file %s at frame %d\n", path, count);
+      fclose(file);
+      return -1;
+    }
+    hashes[count++] = hash;
+  }
+  fclose(file);
+
+  if (count < frames) {
+    printf("Golden file %s only has %d of %d frames\n", path, count, frames);
+    return -1;
+  }
+  return 0;
+}
+
+int run_lockstep(int frames, const char *golden_path, int record) {
+  int max_threads = omp_get_max_threads();
+  int thread_counts[] = {1, 2, 3, max_threads};
+  int num_counts = sizeof(thread_counts) / sizeof(thread_counts[0]);
+  int failures = 0;
+  char label[64];
+
+  // Keep a step length chosen by a scenario's fixed_dt
+  float dt = state.settings.fixed_dt;
+  set_deterministic(1);
+  if (dt > 0.0f)
+    state.settings.fixed_dt = dt;
+
+  uint64_t *reference = malloc(frames * sizeof(uint64_t));
+  uint64_t *hashes = malloc(frames * sizeof(uint64_t));
+  if (!reference || !hashes) {
+    printf("Failed to allocate hash buffers\n");
+    free(reference);
+    free(hashes);
+    return 1;
+  }
+
+  printf("Lockstep: %d frames, seed %u, dt %.4f s\n", frames,
+         state.settings.seed, state.settings.fixed_dt);
+
+  // Single-threaded run is the reference for every other thread count
+  run_frames(1, frames, reference);
+  printf("threads=1: final hash %016" PRIx64 ", %d particles\n",
+         reference[frames - 1], state.particle_count);
+
+  for (int t = 1; t < num_counts; t++) {
+    int threads = thread_counts[t];
+    if (threads <= thread_counts[t - 1])
+      continue;
+    run_frames(threads, frames, hashes);
+    snprintf(label, sizeof(label), "threads=%d", threads);
+    failures += compare_hashes(reference, hashes, frames, label);
+  }
+
+  if (golden_path) {
+    if (record) {
+      if (write_golden(golden_path, reference, frames) < 0)
+        failures++;
+    } else if (read_golden(golden_path, hashes, frames) < 0) {
+      failures++;
+    } else {
+      failures += compare_hashes(hashes, reference, frames, "golden");
+    }
+  }
+
+  omp_set_num_threads(max_threads);
+  free(reference);
+  free(hashes);
+  return failures > 0;
+}
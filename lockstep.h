@@ -0,0 +1,6 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+int run_lockstep(int frames, const char *golden_path, int record);
+
+#endif
@@ -3,33 +3,355 @@
 #include <omp.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "allocator.h"
+#include "barnes_hut.h"
+#include "bench.h"
+#include "brush.h"
+#include "capture.h"
+#include "constraints.h"
 #include "defs.h"
+#include "domain.h"
+#include "governor.h"
+#include "lockstep.h"
+#include "neighbour.h"
+#include "obstacle.h"
+#include "publish.h"
+#include "scenario.h"
+#include "sph.h"
 #include "state.h"
+#include "sweep.h"
+#include "trace.h"
+#include "util.h"
 
 State state;
 
-int main() {
-  srand(time(NULL));
+void print_usage(const char *program) {
+  printf("Usage: %s [options]\n", program);
+  printf("  --deterministic     fixed dt, seeded RNG, ordered contacts\n");
+  printf("  --seed N            RNG seed (default: time, or %u when "
+         "deterministic)\n",
+         DETERMINISTIC_SEED);
+  printf("  --lockstep FRAMES   run headless and compare state hashes across "
+         "thread counts\n");
+  printf("  --golden FILE       compare lockstep hashes against FILE\n");
+  printf("  --record            write lockstep hashes to the golden FILE\n");
+  printf("  --domains N         simulate N vertical strips in worker "
+         "processes\n");
+  printf("  --broad-phase NAME  collision broad phase: grid, lists or sweep\n");
+  printf("  --pages MODE        particle pool pages: default, thp or "
+         "hugetlb\n");
+  printf("  --bench N           benchmark N particles across thread counts\n");
+  printf("  --bench-broad-phase N  compare broad phases on N particles at "
+         "several densities\n");
+  printf("  --bench-balance N   compare collision schedules on a pile of N "
+         "particles\n");
+  printf("  --bench-sph N       SPH throughput on a fluid block of N "
+         "particles\n");
+  printf("  --bench-barnes-hut N  Barnes-Hut accuracy and speed against brute "
+         "force on N particles\n");
+  printf("  --obstacles FILE    static obstacles from a .bmp image or a "
+         "polyline file\n");
+  printf("  --bench-constraints N  constraint solver time for N soft "
+         "bodies\n");
+  printf("  --check-queries N   compare grid queries on N particles against "
+         "brute force, --frames queries\n");
+  printf("  --diagnostics       sum energy, momentum and overlap every step\n");
+  printf("  --trace FILE        write per-step timings and diagnostics as "
+         "CSV\n");
+  printf("  --publish           share particle positions with tools/ readers "
+         "through %s\n",
+         SHM_DEFAULT_NAME);
+  printf("  --capture DIR       write rendered frames to DIR, headless for "
+         "--frames F\n");
+  printf("  --capture-format NAME  png (one file per frame) or yuv (raw "
+         "I420 stream)\n");
+  printf("  --scenario NAME     stock scenario (dam-break, dense-pile, "
+         "sparse-spray, million) or scenario file\n");
+  printf("  --bench-scenario NAME  run a scenario headless for --frames and "
+         "report timings\n");
+  printf("  --model NAME        interaction model: rigid or sph\n");
+  printf("  --long-range NAME   long-range force: none, gravity or "
+         "electrostatic\n");
+  printf("  --theta T           Barnes-Hut opening angle (default: %.2f)\n",
+         BARNES_HUT_THETA);
+  printf("  --schedule NAME     grid collision schedule: cost or static\n");
+  printf("  --frames F          frames for benchmarks, or run --domains "
+         "headless\n");
+  printf("  --budget MS         frame time the quality governor holds, 0 = "
+         "off (default: %.1f)\n",
+         FRAME_BUDGET_MS);
+  printf("  --splat N           splat particles into a texture from N "
+         "particles, -1 = never (default: %d)\n",
+         SPLAT_THRESHOLD);
+}
+
+// Offline run for a capture: every frame is simulated at the fixed step and
+// rendered, however long encoding takes
+static void run_headless(int frames) {
+  if (state.settings.fixed_dt <= 0.0f) {
+    state.settings.fixed_dt = DETERMINISTIC_DT;
+  }
+  for (int f = 0; f < frames; f++) {
+    update_particle_source();
+    update_state();
+    update_fps();
+    clear_screen();
+    render();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int lockstep_frames = 0;
+  const char *golden_path = NULL;
+  const char *obstacle_path = NULL;
+  const char *trace_path = NULL;
+  const char *capture_dir = NULL;
+  CaptureFormat capture_format = CAPTURE_PNG;
+  int record_golden = 0;
+  int publish = 0;
+  int seed_given = 0;
+  int num_domains = 0;
+  int bench_particles = 0;
+  int broad_phase_bench_particles = 0;
+  int balance_bench_particles = 0;
+  int sph_bench_particles = 0;
+  int barnes_hut_bench_particles = 0;
+  int constraint_bench_bodies = 0;
+  int query_check_particles = 0;
+  int scenario_bench = 0;
+  int width, height, capacity;
+  int frames = 0;
+  state.settings.frame_budget_ms = FRAME_BUDGET_MS;
+  state.settings.splat_threshold = SPLAT_THRESHOLD;
+  state.settings.theta = BARNES_HUT_THETA;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--deterministic") == 0) {
+      set_deterministic(1);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      state.settings.seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+      seed_given = 1;
+    } else if (strcmp(argv[i], "--lockstep") == 0 && i + 1 < argc) {
+      lockstep_frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+      golden_path = argv[++i];
+    } else if (strcmp(argv[i], "--record") == 0) {
+      record_golden = 1;
+    } else if (strcmp(argv[i], "--domains") == 0 && i + 1 < argc) {
+      num_domains = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--broad-phase") == 0 && i + 1 < argc) {
+      i++;
+      for (int b = 0; b < BROAD_PHASE_COUNT; b++) {
+        if (strcmp(argv[i], broad_phase_name(b)) == 0)
+          state.settings.broad_phase = b;
+      }
+    } else if (strcmp(argv[i], "--pages") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "thp") == 0) {
+        allocator_set_page_mode(PAGES_TRANSPARENT);
+      } else if (strcmp(argv[i], "hugetlb") == 0) {
+        allocator_set_page_mode(PAGES_HUGETLB);
+      } else {
+        allocator_set_page_mode(PAGES_DEFAULT);
+      }
+    } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+      bench_particles = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-broad-phase") == 0 && i + 1 < argc) {
+      broad_phase_bench_particles = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-balance") == 0 && i + 1 < argc) {
+      balance_bench_particles = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-sph") == 0 && i + 1 < argc) {
+      sph_bench_particles = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-barnes-hut") == 0 && i + 1 < argc) {
+      barnes_hut_bench_particles = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--obstacles") == 0 && i + 1 < argc) {
+      obstacle_path = argv[++i];
+    } else if (strcmp(argv[i], "--bench-constraints") == 0 && i + 1 < argc) {
+      constraint_bench_bodies = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--check-queries") == 0 && i + 1 < argc) {
+      query_check_particles = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--diagnostics") == 0) {
+      state.settings.diagnostics = 1;
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "--publish") == 0) {
+      publish = 1;
+    } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+      capture_dir = argv[++i];
+    } else if (strcmp(argv[i], "--capture-format") == 0 && i + 1 < argc) {
+      i++;
+      for (int f = 0; f < CAPTURE_FORMAT_COUNT; f++) {
+        if (strcmp(argv[i], capture_format_name(f)) == 0)
+          capture_format = f;
+      }
+    } else if ((strcmp(argv[i], "--scenario") == 0 ||
+                strcmp(argv[i], "--bench-scenario") == 0) &&
+               i + 1 < argc) {
+      scenario_bench = strcmp(argv[i], "--bench-scenario") == 0;
+      if (load_scenario(argv[++i]) < 0) {
+        exit(-1);
+      }
+      seed_given = seed_given || scenario_sets_seed();
+    } else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+      i++;
+      state.settings.model =
+          strcmp(argv[i], physics_model_name(MODEL_SPH)) == 0 ? MODEL_SPH
+                                                              : MODEL_RIGID;
+    } else if (strcmp(argv[i], "--long-range") == 0 && i + 1 < argc) {
+      i++;
+      for (int f = 0; f < LONG_RANGE_COUNT; f++) {
+        if (strcmp(argv[i], long_range_force_name(f)) == 0)
+          state.settings.long_range = f;
+      }
+    } else if (strcmp(argv[i], "--theta") == 0 && i + 1 < argc) {
+      state.settings.theta = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--schedule") == 0 && i + 1 < argc) {
+      i++;
+      state.settings.collision_schedule =
+          strcmp(argv[i], "static") == 0 ? SCHEDULE_STATIC : SCHEDULE_COST;
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+      state.settings.frame_budget_ms = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--splat") == 0 && i + 1 < argc) {
+      state.settings.splat_threshold = atoi(argv[++i]);
+    } else {
+      print_usage(argv[0]);
+      exit(strcmp(argv[i], "--help") == 0 ? 0 : -1);
+    }
+  }
+
+  if (!seed_given) {
+    state.settings.seed = (state.settings.deterministic || lockstep_frames > 0)
+                              ? DETERMINISTIC_SEED
+                              : (uint32_t)time(NULL);
+  }
+  seed_random(state.settings.seed);
+
+  // Strips step in worker processes that exit without flushing this file,
+  // and lockstep reruns the simulation once per thread count
+  if (trace_path && num_domains > 0) {
+    printf("--trace is not supported with --domains\n");
+    exit(-1);
+  }
+  if (trace_path && lockstep_frames > 0) {
+    printf("--trace is not supported with --lockstep\n");
+    exit(-1);
+  }
+  if (trace_path && open_trace(trace_path) < 0) {
+    exit(-1);
+  }
 
   // Set OpenMP thread count (use all available cores)
   omp_set_num_threads(omp_get_max_threads());
 
-  if (setup() > 0) {
+  // Multi-process run: workers own strips, this process coordinates
+  if (num_domains > 0) {
+    return run_domains(num_domains, frames, obstacle_path) < 0 ? -1 : 0;
+  }
+
+  // Bind threads to NUMA nodes when built with libnuma
+  if (allocator_bind_threads() > 0) {
+    printf("Bound OpenMP threads to NUMA nodes\n");
+  }
+
+  // Headless regression run: no window, just the physics and the hashes
+  if (lockstep_frames > 0) {
+    scenario_dimensions(&width, &height, &capacity);
+    if (init_scenario_world(capacity) < 0 ||
+        (obstacle_path && load_obstacles(obstacle_path) < 0) ||
+        (publish && open_publisher(SHM_DEFAULT_NAME, capacity) < 0)) {
+      exit(-1);
+    }
+    int result = run_lockstep(lockstep_frames, golden_path, record_golden);
+    close_trace();
+    close_publisher();
+    cleanup_world();
+    allocator_cleanup();
+    return result;
+  }
+
+  if (broad_phase_bench_particles > 0) {
+    return run_broad_phase_benchmark(broad_phase_bench_particles,
+                                     frames > 0 ? frames : 100) < 0
+               ? -1
+               : 0;
+  }
+
+  if (balance_bench_particles > 0) {
+    return run_balance_benchmark(balance_bench_particles,
+                                 frames > 0 ? frames : 100) < 0
+               ? -1
+               : 0;
+  }
+
+  if (sph_bench_particles > 0) {
+    return run_sph_benchmark(sph_bench_particles, frames > 0 ? frames : 100) < 0
+               ? -1
+               : 0;
+  }
+
+  if (barnes_hut_bench_particles > 0) {
+    return run_barnes_hut_benchmark(barnes_hut_bench_particles,
+                                    frames > 0 ? frames : 10) < 0
+               ? -1
+               : 0;
+  }
+
+  if (constraint_bench_bodies > 0) {
+    return run_constraint_benchmark(constraint_bench_bodies,
+                                    frames > 0 ? frames : 100) < 0
+               ? -1
+               : 0;
+  }
+
+  if (query_check_particles > 0) {
+    return run_query_check(query_check_particles,
+                           frames > 0 ? frames : 1000) < 0
+               ? -1
+               : 0;
+  }
+
+  if (scenario_bench) {
+    return run_scenario_benchmark(frames > 0 ? frames : 100) < 0 ? -1 : 0;
+  }
+
+  if (bench_particles > 0) {
+    return run_benchmark(bench_particles, frames > 0 ? frames : 100) < 0 ? -1
+                                                                         : 0;
+  }
+
+  // A capture of a fixed number of frames renders offline, without a window
+  int headless = capture_dir && frames > 0;
+  if (setup(headless) > 0) {
     exit(-1);
   };
 
-  if (allocator_init(MAX_SOURCE_PARTICLES) < 0) {
+  scenario_dimensions(&width, &height, &capacity);
+  if (init_scenario_world(capacity) < 0 ||
+      (obstacle_path && load_obstacles(obstacle_path) < 0) ||
+      (publish && open_publisher(SHM_DEFAULT_NAME, capacity) < 0)) {
     cleanup();
     exit(-1);
   }
 
   init_state();
 
+  if (capture_dir && start_capture(capture_dir, capture_format, headless) < 0) {
+    cleanup();
+    exit(-1);
+  }
+
   SDL_Event e;
   bool running = true;
+  if (headless) {
+    run_headless(frames);
+    running = false;
+  }
+  double render_ms = 0.0;
   while (running) {
     // event loop
     while (SDL_PollEvent(&e) != 0) {
@@ -37,17 +359,34 @@ int main() {
       case SDL_QUIT:
         running = false;
         break;
+      case SDL_MOUSEBUTTONDOWN:
+        if (e.button.button == SDL_BUTTON_LEFT) {
+          brush_press(e.button.x, e.button.y);
+        }
+        break;
+      case SDL_MOUSEBUTTONUP:
+        if (e.button.button == SDL_BUTTON_LEFT) {
+          brush_release();
+        }
+        break;
+      case SDL_MOUSEMOTION:
+        brush_move(e.motion.x, e.motion.y);
+        break;
       case SDL_KEYDOWN:
         switch (e.key.keysym.sym) {
+        case SDLK_1:
+          state.brush.tool = BRUSH_ATTRACT;
+          break;
+        case SDLK_2:
+          state.brush.tool = BRUSH_REPEL;
+          break;
+        case SDLK_3:
+          state.brush.tool = BRUSH_DRAG;
+          break;
         case SDLK_j:
           // Step simulation: reset timestamps and run one update
-          {
-            Uint32 current_time = SDL_GetTicks();
-            for (int i = 0; i < state.particle_count; i++) {
-              state.particles[i].lastupdated = current_time;
-            }
-            update_state();
-          }
+          reset_particle_timestamps();
+          update_state();
           break;
         case SDLK_r:
           reset_state();
@@ -60,16 +399,47 @@ int main() {
           state.settings.is_paused = !state.settings.is_paused;
           if (!state.settings.is_paused) {
             // When resuming, reset all particle timestamps to avoid time jumps
-            Uint32 current_time = SDL_GetTicks();
-            for (int i = 0; i < state.particle_count; i++) {
-              state.particles[i].lastupdated = current_time;
-            }
+            reset_particle_timestamps();
           }
           break;
+        case SDLK_e:
+          state.settings.diagnostics = !state.settings.diagnostics;
+          break;
+        case SDLK_c:
+          // Drop a soft body at the cursor
+          spawn_soft_body(state.brush.x, state.brush.y, SOFT_BODY_SIZE);
+          break;
+        case SDLK_d:
+          // Toggle deterministic mode and restart so the run is reproducible
+          set_deterministic(!state.settings.deterministic);
+          reset_state();
+          init_state();
+          break;
+        case SDLK_b:
+          state.settings.broad_phase =
+              (state.settings.broad_phase + 1) % BROAD_PHASE_COUNT;
+          break;
         case SDLK_v:
           state.settings.show_velocity_vectors =
               !state.settings.show_velocity_vectors;
           break;
+        case SDLK_f:
+          state.settings.model = (state.settings.model + 1) % MODEL_COUNT;
+          break;
+        case SDLK_g:
+          state.settings.long_range =
+              (state.settings.long_range + 1) % LONG_RANGE_COUNT;
+          break;
+        case SDLK_h:
+          state.settings.render_mode =
+              (state.settings.render_mode + 1) % RENDER_MODE_COUNT;
+          break;
+        case SDLK_a:
+          // Toggle the frame-budget governor, back at full quality
+          state.settings.frame_budget_ms =
+              state.settings.frame_budget_ms > 0.0f ? 0.0f : FRAME_BUDGET_MS;
+          reset_governor();
+          break;
         case SDLK_q:
           running = false;
           break;
@@ -77,8 +447,6 @@ int main() {
       }
     }
 
-    clear_screen();
-
     // Only update physics if simulation is not paused
     if (!state.settings.is_paused) {
       // Update particle source (generate new particles)
@@ -87,13 +455,31 @@ int main() {
       update_state();
       // update fps counter only when simulation is running
       update_fps();
+      // adapt quality to the frame budget from this frame's timings; a
+      // skipped render costs nothing, so it counts as 0
+      update_governor(render_ms);
+      render_ms = 0.0;
+    }
+
+    // render loop, skipped on alternate frames when decimated
+    if (state.settings.is_paused || governor_render_this_frame()) {
+      double render_start = omp_get_wtime();
+      clear_screen();
+      render();
+      render_ms = (omp_get_wtime() - render_start) * 1000.0;
     }
-    // render loop
-    render();
   }
 
+  stop_capture();
   cleanup();
   reset_state();
+  cleanup_world();
+  cleanup_neighbour_lists();
+  cleanup_sweep();
+  cleanup_constraints();
+  close_trace();
+  close_publisher();
+  frame_arena_cleanup();
   allocator_cleanup();
   return 0;
 }
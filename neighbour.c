@@ -0,0 +1,164 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+#include "defs.h"
+#include "neighbour.h"
+#include "physics.h"
+#include "state.h"
+
+extern State state;
+
+// Candidate pairs in CSR form: the partners of particle i, all with a higher
+// index, are indices[offsets[i] .. offsets[i + 1])
+static int *offsets;
+static int *indices;
+static int offsets_capacity;
+static int indices_capacity;
+static int built_count = -1; // particle count the lists were built for
+static long rebuilds;
+static long steps;
+
+static int *grow_buffer(int *buffer, int *capacity, int needed) {
+  if (needed <= *capacity)
+    return buffer;
+
+  int new_capacity = needed + needed / 2;
+  allocator_free_buffer(buffer);
+  buffer = allocator_alloc_buffer(new_capacity * sizeof(int));
+  if (!buffer) {
+    printf("Failed to allocate neighbour lists\n");
+    exit(1);
+  }
+  *capacity = new_capacity;
+  return buffer;
+}
+
+void invalidate_neighbour_lists() { built_count = -1; }
+
+// Lists stay valid until some particle has moved half the skin since the last
+// build: two particles approaching each other then close at most the full
+// skin, so no pair can start touching without being listed
+int neighbour_lists_stale(float max_displacement_sq) {
+  float half_skin = NEIGHBOUR_SKIN * 0.5f;
+  return built_count != state.particle_count ||
+         max_displacement_sq > half_skin * half_skin;
+}
+
+// Count the candidates of particle i, writing them to out when it is not NULL
+static int scan_candidates(int i, int *out) {
+  Circle *p = &state.particles[i];
+  int grid_x, grid_y;
+  int count = 0;
+  grid_coords(p->xcenter, p->ycenter, &grid_x, &grid_y);
+
+  for (int y = grid_y - 1; y <= grid_y + 1; y++) {
+    if (y < 0 || y >= state.grid_height)
+      continue;
+    for (int x = grid_x - 1; x <= grid_x + 1; x++) {
+      if (x < 0 || x >= state.grid_width)
+        continue;
+
+      GridCell *cell = &state.grid[y * state.grid_width + x];
+      for (int k = 0; k < cell->count; k++) {
+        int j = cell->particle_indices[k];
+        if (j <= i)
+          continue;
+
+        Circle *q = &state.particles[j];
+        float reach = p->radius + q->radius + NEIGHBOUR_SKIN;
+        float dx = p->xcenter - q->xcenter;
+        float dy = p->ycenter - q->ycenter;
+        if (dx * dx + dy * dy <= reach * reach) {
+          if (out)
+            out[count] = j;
+          count++;
+        }
+      }
+    }
+  }
+
+  return count;
+}
+
+// Build the lists from the freshly assigned grid and restart the displacement
+// tracking in each particle's dx/dy
+void build_neighbour_lists() {
+  int n = state.particle_count;
+
+  offsets = grow_buffer(offsets, &offsets_capacity, n + 1);
+
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+  for (int i = 0; i < n; i++) {
+    offsets[i + 1] = scan_candidates(i, NULL);
+  }
+
+  offsets[0] = 0;
+  for (int i = 0; i < n; i++) {
+    offsets[i + 1] += offsets[i];
+  }
+
+  indices = grow_buffer(indices, &indices_capacity, offsets[n]);
+
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+  for (int i = 0; i < n; i++) {
+    scan_candidates(i, &indices[offsets[i]]);
+    state.particles[i].dx = 0.0f;
+    state.particles[i].dy = 0.0f;
+  }
+
+  built_count = n;
+  rebuilds++;
+}
+
+static inline float particle_neighbours(int i, PairCollisionFn pair) {
+  float deepest = 0.0f;
+  for (int k = offsets[i]; k < offsets[i + 1]; k++) {
+    Circle *partner = &state.particles[indices[k]];
+    deepest = fmaxf(deepest, pair(&state.particles[i], partner));
+  }
+  return deepest;
+}
+
+// The kernel is chosen once per particle, so the pair loop calls it directly
+static float handle_particle_neighbours(int i, int uniform) {
+  return uniform ? particle_neighbours(i, handle_pair_collision_uniform)
+                 : particle_neighbours(i, handle_pair_collision_generic);
+}
+
+float handle_neighbour_collisions() {
+  int uniform = handle_pair_collision == handle_pair_collision_uniform;
+  float deepest = 0.0f;
+  steps++;
+
+  if (state.settings.deterministic) {
+    // Partners are shared between particles, so a reproducible order means a
+    // serial sweep
+    for (int i = 0; i < state.particle_count; i++) {
+      deepest = fmaxf(deepest, handle_particle_neighbours(i, uniform));
+    }
+  } else {
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK) \
+    reduction(max : deepest)
+    for (int i = 0; i < state.particle_count; i++) {
+      deepest = fmaxf(deepest, handle_particle_neighbours(i, uniform));
+    }
+  }
+  return deepest;
+}
+
+void neighbour_list_stats(long *rebuild_count, long *step_count) {
+  *rebuild_count = rebuilds;
+  *step_count = steps;
+}
+
+void cleanup_neighbour_lists() {
+  allocator_free_buffer(offsets);
+  allocator_free_buffer(indices);
+  offsets = NULL;
+  indices = NULL;
+  offsets_capacity = 0;
+  indices_capacity = 0;
+  built_count = -1;
+}
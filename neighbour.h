@@ -0,0 +1,11 @@
+#ifndef NEIGHBOUR_H
+#define NEIGHBOUR_H
+
+int neighbour_lists_stale(float max_displacement_sq);
+void build_neighbour_lists();
+float handle_neighbour_collisions();
+void invalidate_neighbour_lists();
+void neighbour_list_stats(long *rebuilds, long *steps);
+void cleanup_neighbour_lists();
+
+#endif
@@ -0,0 +1,391 @@
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "obstacle.h"
+
+extern State state;
+
+// Squared distance standing in for "no feature pixel in this row or column"
+#define EDT_FAR 1e20f
+#define MAX_POLYLINE_POINTS 1024
+
+// Exact 1D squared distance transform of n samples of f, a stride apart
+// (Felzenszwalb and Huttenlocher), using scratch for the lower envelope
+static void distance_transform_1d(const float *f, int n, int stride,
+                                  float *out, int *v, float *z) {
+  int k = 0;
+  v[0] = 0;
+  z[0] = -INFINITY;
+  z[1] = INFINITY;
+  for (int q = 1; q < n; q++) {
+    float s;
+    for (;;) {
+      int r = v[k];
+      s = (float)(((double)f[q * stride] + (double)q * q -
+                   ((double)f[r * stride] + (double)r * r)) /
+                  (2.0 * (q - r)));
+      if (s > z[k])
+        break;
+      k--;
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = INFINITY;
+  }
+
+  k = 0;
+  for (int q = 0; q < n; q++) {
+    while (z[k + 1] < q)
+      k++;
+    float d = (float)(q - v[k]);
+    out[q] = d * d + f[v[k] * stride];
+  }
+}
+
+// Squared distance of every pixel to the nearest pixel whose mask equals
+// feature, separably over columns and then rows
+static int distance_transform(const unsigned char *mask, unsigned char feature,
+                              int width, int height, float *distance) {
+  int longest = width > height ? width : height;
+  int failed = 0;
+
+  for (int i = 0; i < width * height; i++) {
+    distance[i] = mask[i] == feature ? 0.0f : EDT_FAR;
+  }
+
+#pragma omp parallel reduction(| : failed)
+  {
+    float *line = malloc(longest * sizeof(float));
+    float *z = malloc((longest + 1) * sizeof(float));
+    int *v = malloc(longest * sizeof(int));
+    if (!line || !z || !v) {
+      failed = 1;
+    } else {
+#pragma omp for
+      for (int x = 0; x < width; x++) {
+        distance_transform_1d(&distance[x], height, width, line, v, z);
+        for (int y = 0; y < height; y++) {
+          distance[y * width + x] = line[y];
+        }
+      }
+#pragma omp for
+      for (int y = 0; y < height; y++) {
+        distance_transform_1d(&distance[y * width], width, 1, line, v, z);
+        memcpy(&distance[y * width], line, width * sizeof(float));
+      }
+    }
+    free(line);
+    free(z);
+    free(v);
+  }
+  return failed ? -1 : 0;
+}
+
+void clear_obstacles() {
+  free(state.obstacles.distance);
+  state.obstacles = (ObstacleMap){0};
+}
+
+// Turn a world-sized solid mask into signed distances at the sample points.
+// Pixel distances are measured between pixel centres, so the surface sits
+// half a pixel out from the last solid pixel.
+static int bake_mask(const unsigned char *mask) {
+  int width = state.world_width;
+  int height = state.world_height;
+  int pixels = width * height;
+  float *to_solid = malloc(pixels * sizeof(float));
+  float *to_free = malloc(pixels * sizeof(float));
+  int map_width = (width + OBSTACLE_SDF_SPACING - 1) / OBSTACLE_SDF_SPACING + 1;
+  int map_height =
+      (height + OBSTACLE_SDF_SPACING - 1) / OBSTACLE_SDF_SPACING + 1;
+  float *distance = malloc(map_width * map_height * sizeof(float));
+  if (!to_solid || !to_free || !distance ||
+      distance_transform(mask, 1, width, height, to_solid) < 0 ||
+      distance_transform(mask, 0, width, height, to_free) < 0) {
+    printf("Failed to allocate the obstacle distance field\n");
+    free(to_solid);
+    free(to_free);
+    free(distance);
+    return -1;
+  }
+
+  for (int j = 0; j < map_height; j++) {
+    int y = j * OBSTACLE_SDF_SPACING < height ? j * OBSTACLE_SDF_SPACING
+                                              : height - 1;
+    for (int i = 0; i < map_width; i++) {
+      int x = i * OBSTACLE_SDF_SPACING < width ? i * OBSTACLE_SDF_SPACING
+                                               : width - 1;
+      int p = y * width + x;
+      distance[j * map_width + i] = mask[p]
+                                        ? 0.5f - sqrtf(to_free[p])
+                                        : sqrtf(to_solid[p]) - 0.5f;
+    }
+  }
+  free(to_solid);
+  free(to_free);
+
+  clear_obstacles();
+  state.obstacles = (ObstacleMap){
+      .distance = distance, .width = map_width, .height = map_height};
+  return 0;
+}
+
+static float segment_distance_sq(float px, float py, float ax, float ay,
+                                 float bx, float by) {
+  float ex = bx - ax;
+  float ey = by - ay;
+  float length_sq = ex * ex + ey * ey;
+  float t = length_sq > 0.0f ? ((px - ax) * ex + (py - ay) * ey) / length_sq
+                             : 0.0f;
+  t = fminf(fmaxf(t, 0.0f), 1.0f);
+  float dx = px - (ax + t * ex);
+  float dy = py - (ay + t * ey);
+  return dx * dx + dy * dy;
+}
+
+int set_obstacle_polylines(const Polyline *lines, int count) {
+  int width = state.world_width;
+  int height = state.world_height;
+  unsigned char *mask = calloc((size_t)width * height, 1);
+  if (!mask) {
+    printf("Failed to allocate the obstacle mask\n");
+    return -1;
+  }
+
+  // Mark the pixels within half the line width of any segment
+  float half = 0.5f * OBSTACLE_LINE_WIDTH;
+  for (int l = 0; l < count; l++) {
+    const float *p = lines[l].points;
+    for (int s = 0; s + 1 < lines[l].count; s++) {
+      float ax = p[2 * s], ay = p[2 * s + 1];
+      float bx = p[2 * s + 2], by = p[2 * s + 3];
+      int x0 = (int)fmaxf(floorf(fminf(ax, bx) - half), 0.0f);
+      int y0 = (int)fmaxf(floorf(fminf(ay, by) - half), 0.0f);
+      int x1 = (int)fminf(ceilf(fmaxf(ax, bx) + half), width - 1.0f);
+      int y1 = (int)fminf(ceilf(fmaxf(ay, by) + half), height - 1.0f);
+      for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+          if (segment_distance_sq(x + 0.5f, y + 0.5f, ax, ay, bx, by) <=
+              half * half)
+            mask[y * width + x] = 1;
+        }
+      }
+    }
+  }
+
+  int result = bake_mask(mask);
+  free(mask);
+  return result;
+}
+
+// Pixels darker than OBSTACLE_BITMAP_THRESHOLD are solid. The image is
+// stretched over the world.
+static int load_obstacle_bitmap(const char *path) {
+  SDL_Surface *loaded = SDL_LoadBMP(path);
+  if (!loaded) {
+    printf("Failed to load obstacle bitmap %s: %s\n", path, SDL_GetError());
+    return -1;
+  }
+  SDL_Surface *image =
+      SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+  SDL_FreeSurface(loaded);
+  if (!image) {
+    printf("Failed to convert obstacle bitmap %s: %s\n", path, SDL_GetError());
+    return -1;
+  }
+
+  int width = state.world_width;
+  int height = state.world_height;
+  unsigned char *mask = malloc((size_t)width * height);
+  if (!mask) {
+    printf("Failed to allocate the obstacle mask\n");
+    SDL_FreeSurface(image);
+    return -1;
+  }
+
+  for (int y = 0; y < height; y++) {
+    const Uint32 *row =
+        (const Uint32 *)((const Uint8 *)image->pixels +
+                         (long)y * image->h / height * image->pitch);
+    for (int x = 0; x < width; x++) {
+      Uint32 pixel = row[(long)x * image->w / width];
+      int luminance = (((pixel >> 16) & 0xff) * 3 + ((pixel >> 8) & 0xff) * 6 +
+                       (pixel & 0xff)) /
+                      10;
+      mask[y * width + x] = luminance < OBSTACLE_BITMAP_THRESHOLD;
+    }
+  }
+  SDL_FreeSurface(image);
+
+  int result = bake_mask(mask);
+  free(mask);
+  return result;
+}
+
+// One polyline per line of x y pairs, blank lines and # comments skipped
+static int load_obstacle_text(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    printf("Failed to open obstacle file %s\n", path);
+    return -1;
+  }
+
+  int capacity = 16;
+  int count = 0;
+  Polyline *lines = malloc(capacity * sizeof(Polyline));
+  char buffer[8192];
+  int result = lines ? 0 : -1;
+  while (result == 0 && fgets(buffer, sizeof(buffer), file)) {
+    float points[2 * MAX_POLYLINE_POINTS];
+    int values = 0;
+    char *cursor = buffer;
+    for (;;) {
+      char *end;
+      float value = strtof(cursor, &end);
+      if (end == cursor || values == 2 * MAX_POLYLINE_POINTS)
+        break;
+      points[values++] = value;
+      cursor = end;
+    }
+    if (values < 4)
+      continue;
+
+    if (count == capacity) {
+      capacity *= 2;
+      Polyline *grown = realloc(lines, capacity * sizeof(Polyline));
+      if (!grown) {
+        result = -1;
+        break;
+      }
+      lines = grown;
+    }
+    float *copy = malloc(values * sizeof(float));
+    if (!copy) {
+      result = -1;
+      break;
+    }
+    memcpy(copy, points, values * sizeof(float));
+    lines[count++] = (Polyline){copy, values / 2};
+  }
+  fclose(file);
+
+  if (result < 0) {
+    printf("Failed to read obstacle file %s\n", path);
+  } else if (count == 0) {
+    printf("No polylines in obstacle file %s\n", path);
+    result = -1;
+  } else {
+    result = set_obstacle_polylines(lines, count);
+  }
+
+  for (int l = 0; l < count; l++) {
+    free((float *)lines[l].points);
+  }
+  free(lines);
+  return result;
+}
+
+int load_obstacles(const char *path) {
+  const char *extension = strrchr(path, '.');
+  if (extension && strcmp(extension, ".bmp") == 0) {
+    return load_obstacle_bitmap(path);
+  }
+  return load_obstacle_text(path);
+}
+
+float obstacle_distance(float x, float y, float *grad_x, float *grad_y) {
+  const ObstacleMap *map = &state.obstacles;
+  float fx = x / OBSTACLE_SDF_SPACING;
+  float fy = y / OBSTACLE_SDF_SPACING;
+  int i = (int)fx;
+  int j = (int)fy;
+  i = i < 0 ? 0 : (i > map->width - 2 ? map->width - 2 : i);
+  j = j < 0 ? 0 : (j > map->height - 2 ? map->height - 2 : j);
+  float tx = fminf(fmaxf(fx - i, 0.0f), 1.0f);
+  float ty = fminf(fmaxf(fy - j, 0.0f), 1.0f);
+
+  const float *row = &map->distance[j * map->width + i];
+  float d00 = row[0];
+  float d10 = row[1];
+  float d01 = row[map->width];
+  float d11 = row[map->width + 1];
+  float top = d00 + (d10 - d00) * tx;
+  float bottom = d01 + (d11 - d01) * tx;
+
+  float spacing = OBSTACLE_SDF_SPACING;
+  *grad_x = ((d10 - d00) * (1.0f - ty) + (d11 - d01) * ty) / spacing;
+  *grad_y = (bottom - top) / spacing;
+  return top + (bottom - top) * ty;
+}
+
+// Push a particle that overlaps an obstacle out along the distance gradient
+// and reflect its velocity into the surface, like handle_border_collisions()
+void handle_obstacle_collisions(Circle *particle) {
+  if (!state.obstacles.distance)
+    return;
+
+  float grad_x, grad_y;
+  float distance = obstacle_distance(particle->xcenter, particle->ycenter,
+                                     &grad_x, &grad_y);
+  if (distance >= particle->radius)
+    return;
+  float length = sqrtf(grad_x * grad_x + grad_y * grad_y);
+  if (length <= 0.0f)
+    return;
+
+  float normal_x = grad_x / length;
+  float normal_y = grad_y / length;
+  float push = particle->radius - distance;
+  particle->xcenter += normal_x * push;
+  particle->ycenter += normal_y * push;
+  particle->dx += normal_x * push;
+  particle->dy += normal_y * push;
+
+  float normal_velocity =
+      particle->xvelocity * normal_x + particle->yvelocity * normal_y;
+  if (normal_velocity < 0.0f) {
+    float impulse = (1.0f + particle->cor) * normal_velocity;
+    particle->xvelocity -= impulse * normal_x;
+    particle->yvelocity -= impulse * normal_y;
+  }
+}
+
+// For particles on the swept path: march the distance field from the start of
+// the step towards the end, each time by the clearance to the nearest
+// obstacle, and stop the particle where it first touches one. The minimum
+// stride is well below OBSTACLE_LINE_WIDTH, so thin walls cannot be skipped.
+void handle_swept_obstacle_collisions(Circle *particle, float start_x,
+                                      float start_y) {
+  if (!state.obstacles.distance)
+    return;
+
+  float motion_x = particle->xcenter - start_x;
+  float motion_y = particle->ycenter - start_y;
+  float length = sqrtf(motion_x * motion_x + motion_y * motion_y);
+  float min_stride = OBSTACLE_SDF_SPACING * 0.5f;
+
+  float travelled = 0.0f;
+  while (travelled < length) {
+    float x = start_x + motion_x * (travelled / length);
+    float y = start_y + motion_y * (travelled / length);
+    float grad_x, grad_y;
+    float clearance =
+        obstacle_distance(x, y, &grad_x, &grad_y) - particle->radius;
+    if (clearance < 0.0f) {
+      particle->dx += x - particle->xcenter;
+      particle->dy += y - particle->ycenter;
+      particle->xcenter = x;
+      particle->ycenter = y;
+      break;
+    }
+    travelled += fmaxf(clearance, min_stride);
+  }
+
+  // Push out and reflect at the first contact, or at the end of the step
+  handle_obstacle_collisions(particle);
+}
@@ -0,0 +1,26 @@
+#ifndef OBSTACLE_H
+#define OBSTACLE_H
+
+#include "defs.h"
+
+// An open polyline of count points, stored as x, y pairs in world pixels
+typedef struct Polyline {
+  const float *points;
+  int count;
+} Polyline;
+
+// Bake static geometry into the signed distance field of the current world.
+// load_obstacles() reads a .bmp image, stretched over the world, or a text
+// file with one polyline per line ("x1 y1 x2 y2 ..."). The map lives until
+// the next bake, clear_obstacles() or cleanup_world().
+int load_obstacles(const char *path);
+int set_obstacle_polylines(const Polyline *lines, int count);
+void clear_obstacles();
+
+// Bilinear distance to the obstacles at (x, y) and its gradient
+float obstacle_distance(float x, float y, float *grad_x, float *grad_y);
+void handle_obstacle_collisions(Circle *particle);
+void handle_swept_obstacle_collisions(Circle *particle, float start_x,
+                                      float start_y);
+
+#endif
@@ -3,7 +3,21 @@
 
 #include "defs.h"
 
-void handle_grid_cell_collisions(int grid_x, int grid_y);
+// Both return the deepest overlap they resolved, in pixels
+typedef float (*PairCollisionFn)(Circle *p1, Circle *p2);
+typedef float (*CellCollisionFn)(int grid_x, int grid_y);
+
+// Collision kernels for the current step, see select_collision_kernels()
+extern PairCollisionFn handle_pair_collision;
+extern CellCollisionFn handle_grid_cell_collisions;
+
+// The pair kernels themselves, for broad phases that pick one per particle
+// instead of calling through handle_pair_collision for every pair
+float handle_pair_collision_generic(Circle *p1, Circle *p2);
+float handle_pair_collision_uniform(Circle *p1, Circle *p2);
+
+void select_collision_kernels(int uniform);
+int is_uniform_particle(const Circle *c);
 void handle_border_collisions(Circle *particle);
 void calculate_location(Circle *particle);
 
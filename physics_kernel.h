@@ -0,0 +1,134 @@
+// Collision kernel template, included once per particle layout by physics.c.
+// The includer defines:
+//   KERNEL(name)           - suffixes the generated function names
+//   RADIUS_SUM(a, b)       - contact distance of two particles
+//   COMBINED_COR(a, b)     - coefficient of restitution of a contact
+//   IMPULSE_SHARE(j, o, s) - share of impulse j taken by s, j * o->m over
+//                            the total mass
+// Uniform scenes define these as constants so the compiler folds them.
+
+static void KERNEL(resolve_collision)(Circle *c1, Circle *c2) {
+  // Calculate distance and separation first
+  float dx = c1->xcenter - c2->xcenter;
+  float dy = c1->ycenter - c2->ycenter;
+  float dist = sqrtf(dx * dx + dy * dy);
+  float overlap = RADIUS_SUM(c1, c2) - dist;
+
+  // Separate overlapping particles
+  if (overlap > 0 && dist > 0) {
+    float separation_x = (dx / dist) * (overlap * 0.5f);
+    float separation_y = (dy / dist) * (overlap * 0.5f);
+
+    c1->xcenter += separation_x;
+    c1->ycenter += separation_y;
+    c2->xcenter -= separation_x;
+    c2->ycenter -= separation_y;
+
+    // Separation counts towards the displacement since the last list build
+    c1->dx += separation_x;
+    c1->dy += separation_y;
+    c2->dx -= separation_x;
+    c2->dy -= separation_y;
+  }
+
+  // follow the 7 steps https://www.vobarian.com/collisions/2dcollisions2.pdf
+
+  // step 1: Find the unit tangent and unit normal vectors
+  Vector n =
+      create_vector(c1->xcenter - c2->xcenter, c1->ycenter - c2->ycenter, 0.);
+  Vector u_n = unit_vector(n);
+  Vector u_t = create_vector(-u_n.y, u_n.x, u_n.z);
+
+  // step 2: Create velocity vectors (optional)
+  Vector v1 = create_vector(c1->xvelocity, c1->yvelocity, 0.);
+  Vector v2 = create_vector(c2->xvelocity, c2->yvelocity, 0.);
+  // step 3: Resolve v1 and v2 into normal and tangential components
+  float v1_n = dot_product(u_n, v1);
+  float v1_t = dot_product(u_t, v1);
+  float v2_n = dot_product(u_n, v2);
+  float v2_t = dot_product(u_t, v2);
+
+  // step 4: Find the new tangential velocities after the collision.
+  // They do not change since there is no force between the two circles
+  // in the tangential direction.
+  float v1_t_prime = v1_t;
+  float v2_t_prime = v2_t;
+
+  // step 5: Find the new normal velocities using inelastic collision formula
+  float combined_cor = COMBINED_COR(c1, c2);
+
+  float v1_n_prime =
+      v1_n + IMPULSE_SHARE((1.0f + combined_cor) * (v2_n - v1_n), c2, c1);
+  float v2_n_prime =
+      v2_n + IMPULSE_SHARE((1.0f + combined_cor) * (v1_n - v2_n), c1, c2);
+
+  Vector v1_n_prime_vec = scale_vector(v1_n_prime, u_n);
+  Vector v1_t_prime_vec = scale_vector(v1_t_prime, u_t);
+  Vector v2_n_prime_vec = scale_vector(v2_n_prime, u_n);
+  Vector v2_t_prime_vec = scale_vector(v2_t_prime, u_t);
+
+  Vector v1_prime_vec = add_vectors(v1_n_prime_vec, v1_t_prime_vec);
+
+  Vector v2_prime_vec = add_vectors(v2_n_prime_vec, v2_t_prime_vec);
+
+  c1->yvelocity = v1_prime_vec.y;
+  c1->xvelocity = v1_prime_vec.x;
+
+  c2->yvelocity = v2_prime_vec.y;
+  c2->xvelocity = v2_prime_vec.x;
+}
+
+// Returns how deep the particles overlapped, 0 if they did not touch
+float KERNEL(handle_pair_collision)(Circle *p1, Circle *p2) {
+  float dx = p1->xcenter - p2->xcenter;
+  float dy = p1->ycenter - p2->ycenter;
+  float dist = eucledean_dist(dx, dy);
+
+  if (dist <= RADIUS_SUM(p1, p2)) {
+    KERNEL(resolve_collision)(p1, p2);
+    return RADIUS_SUM(p1, p2) - dist;
+  }
+  return 0.0f;
+}
+
+// Returns the deepest overlap of the cell's contacts
+static float KERNEL(handle_grid_cell_collisions)(int grid_x, int grid_y) {
+  GridCell *cell = &state.grid[grid_y * state.grid_width + grid_x];
+  float deepest = 0.0f;
+
+  // Check collisions within current cell
+  for (int i = 0; i < cell->count; i++) {
+    for (int j = i + 1; j < cell->count; j++) {
+      int idx1 = cell->particle_indices[i];
+      int idx2 = cell->particle_indices[j];
+
+      deepest = fmaxf(deepest,
+                      KERNEL(handle_pair_collision)(&state.particles[idx1],
+                                                    &state.particles[idx2]));
+    }
+  }
+
+  // Check collisions with adjacent cells (right and down to avoid duplicates)
+  int adjacent_cells[2][2] = {{1, 0}, {0, 1}};
+
+  for (int adj = 0; adj < 2; adj++) {
+    int adj_x = grid_x + adjacent_cells[adj][0];
+    int adj_y = grid_y + adjacent_cells[adj][1];
+
+    if (adj_x < state.grid_width && adj_y < state.grid_height) {
+      GridCell *adj_cell = &state.grid[adj_y * state.grid_width + adj_x];
+
+      for (int i = 0; i < cell->count; i++) {
+        for (int j = 0; j < adj_cell->count; j++) {
+          int idx1 = cell->particle_indices[i];
+          int idx2 = adj_cell->particle_indices[j];
+
+          deepest = fmaxf(deepest, KERNEL(handle_pair_collision)(
+                                       &state.particles[idx1],
+                                       &state.particles[idx2]));
+        }
+      }
+    }
+  }
+  return deepest;
+}
@@ -0,0 +1,115 @@
+#include <SDL2/SDL_timer.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "defs.h"
+#include "publish.h"
+
+extern State state;
+
+static ShmHeader *header;
+static size_t mapping_size;
+static char shm_name[256];
+static ShmSlot *writing; // slot being filled by the current step
+static uint64_t frame;
+
+static ShmSlot *ring_slot(uint64_t f) {
+  return (ShmSlot *)((char *)header + header->data_offset +
+                     (f % header->slots) * header->slot_bytes);
+}
+
+int open_publisher(const char *name, int capacity) {
+  size_t slot_bytes = sizeof(ShmSlot) + (size_t)capacity * sizeof(ShmParticle);
+  slot_bytes = (slot_bytes + 63) & ~(size_t)63;
+  size_t data_offset = (sizeof(ShmHeader) + 63) & ~(size_t)63;
+  size_t size = data_offset + SHM_RING_SLOTS * slot_bytes;
+
+  // A segment left by a crashed run still carries a valid magic, so readers
+  // would take its stale header for ours. Start from a fresh one.
+  shm_unlink(name);
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    printf("Failed to create shared memory %s\n", name);
+    return -1;
+  }
+  if (ftruncate(fd, size) < 0) {
+    printf("Failed to size shared memory %s\n", name);
+    close(fd);
+    shm_unlink(name);
+    return -1;
+  }
+  void *memory =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    printf("Failed to map shared memory %s\n", name);
+    shm_unlink(name);
+    return -1;
+  }
+
+  header = memory;
+  mapping_size = size;
+  snprintf(shm_name, sizeof(shm_name), "%s", name);
+  frame = 0;
+  header->version = SHM_VERSION;
+  header->slots = SHM_RING_SLOTS;
+  header->capacity = capacity;
+  header->world_width = state.world_width;
+  header->world_height = state.world_height;
+  header->slot_bytes = slot_bytes;
+  header->data_offset = data_offset;
+  atomic_store_explicit(&header->latest, 0, memory_order_relaxed);
+  for (int s = 0; s < SHM_RING_SLOTS; s++) {
+    atomic_store_explicit(&ring_slot(s)->sequence, 0, memory_order_relaxed);
+  }
+  // Readers check the magic last, once the rest of the header is valid
+  atomic_thread_fence(memory_order_release);
+  header->magic = SHM_MAGIC;
+  return 0;
+}
+
+void close_publisher() {
+  if (!header)
+    return;
+  munmap(header, mapping_size);
+  shm_unlink(shm_name);
+  header = NULL;
+}
+
+ShmParticle *begin_publish(int *count) {
+  *count = 0;
+  if (!header)
+    return NULL;
+
+  // The slot about to be reused holds the oldest frame, so readers of the
+  // latest frames are never disturbed
+  writing = ring_slot(frame + 1);
+  uint32_t sequence =
+      atomic_load_explicit(&writing->sequence, memory_order_relaxed);
+  atomic_store_explicit(&writing->sequence, sequence + 1,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  int capacity = header->capacity;
+  *count = state.particle_count < capacity ? state.particle_count : capacity;
+  writing->count = *count;
+  writing->frame = frame + 1;
+  writing->time = state.settings.fixed_dt > 0.0f ? state.sim_time
+                                                 : SDL_GetTicks() / 1000.0;
+  return writing->particles;
+}
+
+void end_publish() {
+  if (!header)
+    return;
+
+  uint32_t sequence =
+      atomic_load_explicit(&writing->sequence, memory_order_relaxed);
+  atomic_store_explicit(&writing->sequence, sequence + 1,
+                        memory_order_release);
+  frame++;
+  atomic_store_explicit(&header->latest, frame, memory_order_release);
+}
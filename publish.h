@@ -0,0 +1,23 @@
+#ifndef PUBLISH_H
+#define PUBLISH_H
+
+#include "defs.h"
+#include "shm_layout.h"
+
+// Live particle positions for external tools, in the POSIX shared-memory
+// ring described in shm_layout.h
+
+int open_publisher(const char *name, int capacity);
+void close_publisher();
+
+// Claim the next ring slot for this step. Returns the slot's particle array,
+// with room for *count particles, or NULL when not publishing.
+ShmParticle *begin_publish(int *count);
+void end_publish();
+
+static inline void publish_particle(ShmParticle *out, const Circle *p) {
+  *out = (ShmParticle){p->xcenter, p->ycenter, p->radius,
+                       p->color.r, p->color.g, p->color.b, 0};
+}
+
+#endif
@@ -0,0 +1,199 @@
+#include <math.h>
+
+#include "allocator.h"
+#include "defs.h"
+#include "query.h"
+#include "state.h"
+
+extern State state;
+
+// Particles may have moved since the grid was built (collisions run after the
+// assignment), so every cell range is widened by this many cells
+#define QUERY_CELL_MARGIN 1
+
+typedef struct QueryOutput {
+  int *indices;
+  int max;
+  int count;
+} QueryOutput;
+
+static void ensure_grid() {
+  if (!state.grid_current)
+    assign_particles_to_grid();
+}
+
+static void collect(int index, void *user) {
+  QueryOutput *output = user;
+  if (output->count < output->max)
+    output->indices[output->count] = index;
+  output->count++;
+}
+
+// Visit every particle in the cells overlapping the rectangle plus the margin
+// and report those that pass the exact test. Returns the number reported.
+static int visit_cells(float min_x, float min_y, float max_x, float max_y,
+                       float center_x, float center_y, float radius_sq,
+                       int round, QueryCallback callback, void *user) {
+  int cell_min_x, cell_min_y, cell_max_x, cell_max_y;
+  grid_coords(min_x - QUERY_CELL_MARGIN * GRID_CELL_SIZE,
+              min_y - QUERY_CELL_MARGIN * GRID_CELL_SIZE, &cell_min_x,
+              &cell_min_y);
+  grid_coords(max_x + QUERY_CELL_MARGIN * GRID_CELL_SIZE,
+              max_y + QUERY_CELL_MARGIN * GRID_CELL_SIZE, &cell_max_x,
+              &cell_max_y);
+
+  int found = 0;
+  for (int y = cell_min_y; y <= cell_max_y; y++) {
+    for (int x = cell_min_x; x <= cell_max_x; x++) {
+      GridCell *cell = &state.grid[y * state.grid_width + x];
+      for (int i = 0; i < cell->count; i++) {
+        int index = cell->particle_indices[i];
+        Circle *p = &state.particles[index];
+        int inside;
+        if (round) {
+          float dx = p->xcenter - center_x;
+          float dy = p->ycenter - center_y;
+          inside = dx * dx + dy * dy <= radius_sq;
+        } else {
+          inside = p->xcenter >= min_x && p->xcenter <= max_x &&
+                   p->ycenter >= min_y && p->ycenter <= max_y;
+        }
+        if (inside) {
+          callback(index, user);
+          found++;
+        }
+      }
+    }
+  }
+  return found;
+}
+
+int query_radius(float x, float y, float radius, QueryCallback callback,
+                 void *user) {
+  ensure_grid();
+  return visit_cells(x - radius, y - radius, x + radius, y + radius, x, y,
+                     radius * radius, 1, callback, user);
+}
+
+// Bulk variants write at most max_out indices and return the total number of
+// matches, which may be larger
+int query_radius_bulk(float x, float y, float radius, int *out, int max_out) {
+  QueryOutput output = {out, max_out, 0};
+  query_radius(x, y, radius, collect, &output);
+  return output.count;
+}
+
+int query_rect(float min_x, float min_y, float max_x, float max_y,
+               QueryCallback callback, void *user) {
+  ensure_grid();
+  return visit_cells(min_x, min_y, max_x, max_y, 0.0f, 0.0f, 0.0f, 0, callback,
+                     user);
+}
+
+int query_rect_bulk(float min_x, float min_y, float max_x, float max_y,
+                    int *out, int max_out) {
+  QueryOutput output = {out, max_out, 0};
+  query_rect(min_x, min_y, max_x, max_y, collect, &output);
+  return output.count;
+}
+
+static int ring_covers_grid(int center_x, int center_y, int ring) {
+  return center_x - ring <= 0 && center_y - ring <= 0 &&
+         center_x + ring >= state.grid_width - 1 &&
+         center_y + ring >= state.grid_height - 1;
+}
+
+// Lower bound on the distance from (x, y) to anything binned outside the ring
+// of cells around (center_x, center_y). Only sides with cells beyond them
+// count, so points off the world (whose centre cell is clamped) get the real
+// distance.
+static float ring_reach(float x, float y, int center_x, int center_y,
+                        int ring) {
+  float reach = INFINITY;
+  if (center_x - ring > 0)
+    reach = fminf(reach, x - (float)(center_x - ring) * GRID_CELL_SIZE);
+  if (center_x + ring < state.grid_width - 1)
+    reach = fminf(reach, (float)(center_x + ring + 1) * GRID_CELL_SIZE - x);
+  if (center_y - ring > 0)
+    reach = fminf(reach, y - (float)(center_y - ring) * GRID_CELL_SIZE);
+  if (center_y + ring < state.grid_height - 1)
+    reach = fminf(reach, (float)(center_y + ring + 1) * GRID_CELL_SIZE - y);
+
+  // Particles may have left their cell since the grid was built
+  return reach - QUERY_CELL_MARGIN * GRID_CELL_SIZE;
+}
+
+// Search rings of cells around (x, y), keeping the k best in an insertion
+// sorted array, until no unvisited cell can hold anything closer. Returns the
+// number found, at most k.
+int query_nearest_bulk(float x, float y, int k, int *out, float *out_dist_sq) {
+  ensure_grid();
+  if (k <= 0 || state.particle_count == 0)
+    return 0;
+
+  int center_x, center_y;
+  grid_coords(x, y, &center_x, &center_y);
+  int found = 0;
+
+  for (int ring = 0;; ring++) {
+    for (int cy = center_y - ring; cy <= center_y + ring; cy++) {
+      if (cy < 0 || cy >= state.grid_height)
+        continue;
+      // Inner rows only contribute the two cells on the ring's edge
+      int step = (cy == center_y - ring || cy == center_y + ring)
+                     ? 1
+                     : (ring > 0 ? 2 * ring : 1);
+      for (int cx = center_x - ring; cx <= center_x + ring; cx += step) {
+        if (cx < 0 || cx >= state.grid_width)
+          continue;
+
+        GridCell *cell = &state.grid[cy * state.grid_width + cx];
+        for (int i = 0; i < cell->count; i++) {
+          int index = cell->particle_indices[i];
+          float dx = state.particles[index].xcenter - x;
+          float dy = state.particles[index].ycenter - y;
+          float dist_sq = dx * dx + dy * dy;
+          if (found == k && dist_sq >= out_dist_sq[k - 1])
+            continue;
+
+          int slot = found < k ? found++ : k - 1;
+          while (slot > 0 && out_dist_sq[slot - 1] > dist_sq) {
+            out[slot] = out[slot - 1];
+            out_dist_sq[slot] = out_dist_sq[slot - 1];
+            slot--;
+          }
+          out[slot] = index;
+          out_dist_sq[slot] = dist_sq;
+        }
+      }
+    }
+
+    if (ring_covers_grid(center_x, center_y, ring))
+      break;
+
+    // Anything outside this ring is at least this far away
+    float reach = ring_reach(x, y, center_x, center_y, ring);
+    if (found == k && reach > 0.0f && out_dist_sq[k - 1] <= reach * reach)
+      break;
+  }
+
+  return found;
+}
+
+int query_nearest(float x, float y, int k, QueryCallback callback,
+                  void *user) {
+  if (k <= 0)
+    return 0;
+
+  // Scratch for the sorted result, released with the frame arena
+  int *indices = frame_alloc(k * sizeof(int));
+  float *dist_sq = frame_alloc(k * sizeof(float));
+  if (!indices || !dist_sq)
+    return 0;
+
+  int found = query_nearest_bulk(x, y, k, indices, dist_sq);
+  for (int i = 0; i < found; i++) {
+    callback(indices[i], user);
+  }
+  return found;
+}
@@ -0,0 +1,24 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+// Spatial queries over the collision grid. Call them from serial code: if the
+// grid is out of date they rebuild it first.
+
+typedef void (*QueryCallback)(int index, void *user);
+
+// Particles whose centre lies within radius of (x, y)
+int query_radius(float x, float y, float radius, QueryCallback callback,
+                 void *user);
+int query_radius_bulk(float x, float y, float radius, int *out, int max_out);
+
+// Particles whose centre lies in the rectangle [min_x, max_x] x [min_y, max_y]
+int query_rect(float min_x, float min_y, float max_x, float max_y,
+               QueryCallback callback, void *user);
+int query_rect_bulk(float min_x, float min_y, float max_x, float max_y,
+                    int *out, int max_out);
+
+// The k particles whose centres are closest to (x, y), nearest first
+int query_nearest(float x, float y, int k, QueryCallback callback, void *user);
+int query_nearest_bulk(float x, float y, int k, int *out, float *out_dist_sq);
+
+#endif
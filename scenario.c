@@ -0,0 +1,417 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "barnes_hut.h"
+#include "defs.h"
+#include "obstacle.h"
+#include "scenario.h"
+#include "sph.h"
+#include "state.h"
+#include "util.h"
+
+extern State state;
+
+#define SCENARIO_MAX_BLOCKS 16
+#define SCENARIO_MAX_POLYLINES 16
+#define SCENARIO_MAX_POINTS 64
+
+// A rectangle filled with particles at the given spacing, on a lattice or
+// at hashed random positions, moving in random directions up to speed
+typedef struct ScenarioBlock {
+  float x, y, width, height;
+  float spacing;
+  float speed;
+  int random;
+} ScenarioBlock;
+
+static struct {
+  int loaded;
+  char name[256];
+  int world_width;
+  int world_height;
+  int capacity; // 0 = the particles placed plus the emitter's budget
+  int seeded;
+  int has_emitter; // replaces the default emitter, possibly with none
+  ParticleSource source;
+  ScenarioBlock blocks[SCENARIO_MAX_BLOCKS];
+  int block_count;
+  char obstacle_path[1024];
+  float points[SCENARIO_MAX_POLYLINES][2 * SCENARIO_MAX_POINTS];
+  Polyline lines[SCENARIO_MAX_POLYLINES];
+  int line_count;
+} scenario;
+
+const char *const stock_scenarios[] = {"dam-break", "dense-pile",
+                                       "sparse-spray", "million", NULL};
+
+static const char *const stock_texts[] = {
+    // A fluid column collapsing away from the left wall
+    "world 800 600\n"
+    "seed 1\n"
+    "deterministic 1\n"
+    "model sph\n"
+    "emitter none\n"
+    "block 5 200 240 395 4 lattice 0\n",
+
+    // The bottom half of the box packed solid, the worst case for the
+    // collision phase
+    "world 800 600\n"
+    "seed 2\n"
+    "deterministic 1\n"
+    "model rigid\n"
+    "emitter none\n"
+    "block 5 300 790 295 4.2 lattice 5\n",
+
+    // A thin fast gas with an emitter spraying into it over a deflector
+    "world 800 600\n"
+    "seed 3\n"
+    "deterministic 1\n"
+    "model rigid\n"
+    "emitter left 700 100 30 400 200 20000\n"
+    "block 5 5 790 590 16 random 200\n"
+    "polyline 150 450 400 540 650 450\n",
+
+    // A million particles on a lattice, for scaling runs
+    "world 6016 6016\n"
+    "seed 4\n"
+    "deterministic 1\n"
+    "model rigid\n"
+    "emitter none\n"
+    "block 8 8 6000 6000 6 lattice 20\n",
+};
+
+const char *scenario_name() { return scenario.loaded ? scenario.name : NULL; }
+
+int scenario_sets_seed() { return scenario.seeded; }
+
+// Parse up to count numbers from the rest of the line, returns how many
+static int parse_numbers(char *cursor, float *values, int count) {
+  int parsed = 0;
+  while (parsed < count) {
+    char *end;
+    float value = strtof(cursor, &end);
+    if (end == cursor)
+      break;
+    values[parsed++] = value;
+    cursor = end;
+  }
+  return parsed;
+}
+
+// "emitter SIDE X Y SIZE RATE SPEED LIMIT" or "emitter none"
+static int parse_emitter(char *args) {
+  static const char *sides[] = {"left", "right", "top", "bottom"};
+  char side[16];
+  int consumed = 0;
+  scenario.has_emitter = 1;
+  scenario.source = (ParticleSource){0};
+  if (sscanf(args, "%15s%n", side, &consumed) != 1)
+    return -1;
+  if (strcmp(side, "none") == 0)
+    return 0;
+
+  float values[6];
+  if (parse_numbers(args + consumed, values, 6) != 6)
+    return -1;
+  for (int s = 0; s < 4; s++) {
+    if (strcmp(side, sides[s]) == 0) {
+      scenario.source = (ParticleSource){.x = values[0],
+                                         .y = values[1],
+                                         .width = values[2],
+                                         .height = values[2],
+                                         .flow_rate = values[3],
+                                         .velocity_magnitude = values[4],
+                                         .max_particles = (int)values[5],
+                                         .is_active = 1,
+                                         .emitter_side = (EmitterSide)s};
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int parse_block(char *args) {
+  float values[5];
+  char packing[16];
+  char *cursor = args;
+  for (int k = 0; k < 5; k++) {
+    char *end;
+    values[k] = strtof(cursor, &end);
+    if (end == cursor)
+      return -1;
+    cursor = end;
+  }
+  float speed = 0.0f;
+  int consumed = 0;
+  if (sscanf(cursor, "%15s %f%n", packing, &speed, &consumed) < 1)
+    return -1;
+  if (scenario.block_count == SCENARIO_MAX_BLOCKS || values[4] <= 0.0f ||
+      (strcmp(packing, "lattice") != 0 && strcmp(packing, "random") != 0))
+    return -1;
+
+  scenario.blocks[scenario.block_count++] =
+      (ScenarioBlock){values[0], values[1], values[2], values[3],
+                      values[4], speed, strcmp(packing, "random") == 0};
+  return 0;
+}
+
+static int parse_polyline(char *args) {
+  if (scenario.line_count == SCENARIO_MAX_POLYLINES)
+    return -1;
+  float *points = scenario.points[scenario.line_count];
+  int values = parse_numbers(args, points, 2 * SCENARIO_MAX_POINTS);
+  if (values < 4)
+    return -1;
+  scenario.lines[scenario.line_count++] = (Polyline){points, values / 2};
+  return 0;
+}
+
+// One "key values" setting per line, # starts a comment
+static int parse_line(char *line) {
+  char *comment = strchr(line, '#');
+  if (comment)
+    *comment = '\0';
+  char key[32];
+  int consumed = 0;
+  if (sscanf(line, "%31s%n", key, &consumed) != 1)
+    return 0; // blank
+  char *args = line + consumed;
+  char word[64];
+  float value;
+
+  if (strcmp(key, "world") == 0) {
+    float size[2];
+    if (parse_numbers(args, size, 2) != 2 || size[0] < GRID_CELL_SIZE ||
+        size[1] < GRID_CELL_SIZE)
+      return -1;
+    scenario.world_width = (int)size[0];
+    scenario.world_height = (int)size[1];
+  } else if (strcmp(key, "capacity") == 0) {
+    if (parse_numbers(args, &value, 1) != 1 || value < 1)
+      return -1;
+    scenario.capacity = (int)value;
+  } else if (strcmp(key, "seed") == 0) {
+    if (parse_numbers(args, &value, 1) != 1)
+      return -1;
+    state.settings.seed = (uint32_t)strtoul(args, NULL, 10);
+    scenario.seeded = 1;
+  } else if (strcmp(key, "deterministic") == 0) {
+    if (parse_numbers(args, &value, 1) != 1)
+      return -1;
+    set_deterministic(value != 0.0f);
+  } else if (strcmp(key, "fixed_dt") == 0) {
+    if (parse_numbers(args, &value, 1) != 1 || value < 0.0f)
+      return -1;
+    state.settings.fixed_dt = value;
+  } else if (strcmp(key, "theta") == 0) {
+    if (parse_numbers(args, &value, 1) != 1)
+      return -1;
+    state.settings.theta = value;
+  } else if (strcmp(key, "model") == 0) {
+    if (sscanf(args, "%63s", word) != 1)
+      return -1;
+    state.settings.model = strcmp(word, physics_model_name(MODEL_SPH)) == 0
+                               ? MODEL_SPH
+                               : MODEL_RIGID;
+  } else if (strcmp(key, "broad_phase") == 0) {
+    if (sscanf(args, "%63s", word) != 1)
+      return -1;
+    for (int b = 0; b < BROAD_PHASE_COUNT; b++) {
+      if (strcmp(word, broad_phase_name(b)) == 0)
+        state.settings.broad_phase = b;
+    }
+  } else if (strcmp(key, "long_range") == 0) {
+    if (sscanf(args, "%63s", word) != 1)
+      return -1;
+    for (int f = 0; f < LONG_RANGE_COUNT; f++) {
+      if (strcmp(word, long_range_force_name(f)) == 0)
+        state.settings.long_range = f;
+    }
+  } else if (strcmp(key, "emitter") == 0) {
+    return parse_emitter(args);
+  } else if (strcmp(key, "block") == 0) {
+    return parse_block(args);
+  } else if (strcmp(key, "polyline") == 0) {
+    return parse_polyline(args);
+  } else if (strcmp(key, "obstacles") == 0) {
+    if (sscanf(args, "%1023s", scenario.obstacle_path) != 1)
+      return -1;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static int parse_scenario(const char *text, const char *name) {
+  memset(&scenario, 0, sizeof(scenario));
+  scenario.world_width = SCREEN_WIDTH;
+  scenario.world_height = SCREEN_HEIGHT;
+  snprintf(scenario.name, sizeof(scenario.name), "%s", name);
+
+  int number = 0;
+  while (*text) {
+    const char *end = strchr(text, '\n');
+    size_t length = end ? (size_t)(end - text) : strlen(text);
+    char line[8192];
+    if (length >= sizeof(line))
+      length = sizeof(line) - 1;
+    memcpy(line, text, length);
+    line[length] = '\0';
+    number++;
+    if (parse_line(line) < 0) {
+      printf("Scenario %s, line %d: cannot parse \"%s\"\n", name, number,
+             line);
+      return -1;
+    }
+    text = end ? end + 1 : text + length;
+  }
+  scenario.loaded = 1;
+  return 0;
+}
+
+int load_scenario(const char *name_or_path) {
+  for (int s = 0; stock_scenarios[s]; s++) {
+    if (strcmp(name_or_path, stock_scenarios[s]) == 0)
+      return parse_scenario(stock_texts[s], name_or_path);
+  }
+
+  FILE *file = fopen(name_or_path, "r");
+  if (!file) {
+    printf("No stock scenario or file named %s\n", name_or_path);
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *text = malloc(size + 1);
+  if (!text || fread(text, 1, size, file) != (size_t)size) {
+    printf("Failed to read scenario %s\n", name_or_path);
+    free(text);
+    fclose(file);
+    return -1;
+  }
+  text[size] = '\0';
+  fclose(file);
+
+  int result = parse_scenario(text, name_or_path);
+  free(text);
+  return result;
+}
+
+static int block_columns(const ScenarioBlock *block) {
+  return (int)(block->width / block->spacing);
+}
+
+static int block_particles(const ScenarioBlock *block) {
+  if (block->random) {
+    return (int)(block->width * block->height /
+                 (block->spacing * block->spacing));
+  }
+  return block_columns(block) * (int)(block->height / block->spacing);
+}
+
+void scenario_dimensions(int *width, int *height, int *capacity) {
+  *width = SCREEN_WIDTH;
+  *height = SCREEN_HEIGHT;
+  *capacity = MAX_SOURCE_PARTICLES;
+  if (!scenario.loaded)
+    return;
+
+  *width = scenario.world_width;
+  *height = scenario.world_height;
+  if (scenario.capacity > 0) {
+    *capacity = scenario.capacity;
+  } else {
+    long placed = 0;
+    for (int b = 0; b < scenario.block_count; b++)
+      placed += block_particles(&scenario.blocks[b]);
+    int emitted = !scenario.has_emitter ? MAX_SOURCE_PARTICLES
+                  : scenario.source.is_active
+                      ? scenario.source.max_particles
+                      : 0;
+    *capacity = placed + emitted > 0 ? (int)(placed + emitted) : 1;
+  }
+}
+
+int init_scenario_world(int pool_size) {
+  int width, height, capacity;
+  scenario_dimensions(&width, &height, &capacity);
+  if (allocator_init(pool_size) < 0 || init_world(width, height) < 0) {
+    return -1;
+  }
+  if (scenario.line_count > 0 &&
+      set_obstacle_polylines(scenario.lines, scenario.line_count) < 0) {
+    return -1;
+  }
+  if (scenario.obstacle_path[0] &&
+      load_obstacles(scenario.obstacle_path) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// Fill a block in parallel. Every particle is a function of its index and
+// the seed, so the result does not depend on the thread count.
+static void place_block(const ScenarioBlock *block, int block_index) {
+  int count = block_particles(block);
+  if (count > allocator_free_slots())
+    count = allocator_free_slots();
+  if (count <= 0)
+    return;
+
+  int columns = block_columns(block);
+  uint32_t salt = hash_index(state.settings.seed + block_index);
+  Uint32 now = simulation_ticks();
+  int first_id = state.next_particle_id;
+  int first = add_particles(count);
+
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+  for (int i = 0; i < count; i++) {
+    uint32_t h = hash_index(i ^ salt);
+    uint32_t g = hash_index(h);
+    float x, y;
+    if (block->random) {
+      x = block->x + (h & 0xffff) / 65535.0f * block->width;
+      y = block->y + (h >> 16) / 65535.0f * block->height;
+    } else {
+      x = block->x + (i % columns + 0.5f) * block->spacing;
+      y = block->y + (i / columns + 0.5f) * block->spacing;
+    }
+    float angle = (g & 0xffff) / 65535.0f * 2.0f * (float)M_PI;
+    float speed = (g >> 16) / 65535.0f * block->speed;
+    Color color = USE_RANDOM_COLORS
+                      ? (Color){50 + h % 206, 50 + (h >> 8) % 206,
+                                50 + (h >> 16) % 206}
+                      : Color_CIRCLE;
+    int id = first_id + i;
+    state.particles[first + i] =
+        (Circle){.xcenter = x,
+                 .ycenter = y,
+                 .radius = PARTICLE_RADIUS,
+                 .xvelocity = cosf(angle) * speed,
+                 .yvelocity = sinf(angle) * speed,
+                 .m = PARTICLE_MASS,
+                 .cor = PARTICLE_COR,
+                 .charge = id % 2 ? 1.0f : -1.0f,
+                 .color = color,
+                 .id = id,
+                 .lastupdated = now};
+  }
+}
+
+void apply_scenario() {
+  if (!scenario.loaded)
+    return;
+
+  if (scenario.has_emitter) {
+    Uint32 now = simulation_ticks();
+    state.source = scenario.source;
+    state.source.last_spawn_time = now;
+  }
+  for (int b = 0; b < scenario.block_count; b++) {
+    place_block(&scenario.blocks[b], b);
+  }
+}
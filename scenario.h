@@ -0,0 +1,28 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+// Declarative scenes: world size, emitter, particle blocks, obstacles, solver
+// settings and seed, from a text file or one of the stock scenarios. Solver
+// settings are applied at load time, so command-line options given after
+// --scenario override them.
+
+int load_scenario(const char *name_or_path);
+const char *scenario_name();
+int scenario_sets_seed();
+
+// World size and the particle pool that holds every particle of the loaded
+// scenario, or the default screen-sized world without one
+void scenario_dimensions(int *width, int *height, int *capacity);
+
+// A pool of pool_size particles, the world and the obstacles of the loaded
+// scenario
+int init_scenario_world(int pool_size);
+
+// Emitter and particle blocks, called by init_state() after every reset so
+// the GUI, lockstep runs and benchmarks start from the same state
+void apply_scenario();
+
+// Names of the built-in scenarios, NULL-terminated
+extern const char *const stock_scenarios[];
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SHM_LAYOUT_H
+#define SHM_LAYOUT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Layout of the shared-memory particle ring shared by the simulation
+// (publish.c) and the readers in tools/. A ShmHeader is followed by `slots`
+// ring slots of `slot_bytes` each: a ShmSlot and `capacity` ShmParticles.
+
+#define SHM_DEFAULT_NAME "/sdl_fun_particles"
+#define SHM_MAGIC 0x50464453u // "SDFP"
+#define SHM_VERSION 1
+#define SHM_RING_SLOTS 4
+
+typedef struct ShmParticle {
+  float x;
+  float y;
+  float radius;
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+  uint8_t pad;
+} ShmParticle;
+
+typedef struct ShmHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slots;
+  uint32_t capacity; // particles per slot
+  uint32_t world_width;
+  uint32_t world_height;
+  uint64_t slot_bytes;
+  uint64_t data_offset;    // from the start of the mapping to slot 0
+  _Atomic uint64_t latest; // last complete frame, 0 before the first one
+} ShmHeader;
+
+// Seqlock per slot: sequence is odd while the simulation writes the slot and
+// even once the frame is complete. Frame f lives in slot f % slots.
+typedef struct ShmSlot {
+  _Atomic uint32_t sequence;
+  uint32_t count;
+  uint64_t frame;
+  double time; // seconds since the simulation started publishing
+  ShmParticle particles[];
+} ShmSlot;
+
+#endif
@@ -0,0 +1,166 @@
+#include <math.h>
+
+#include "allocator.h"
+#include "defs.h"
+#include "sph.h"
+#include "state.h"
+
+extern State state;
+
+// 2D kernels from Mueller et al. 2003, with their normalization constants
+// folded once for the configured smoothing length
+typedef struct SphKernels {
+  float h;
+  float h_sq;
+  float poly6;         // W(r) = poly6 * (h^2 - r^2)^3
+  float spiky_grad;    // |grad W(r)| = spiky_grad * (h - r)^2
+  float viscosity_lap; // laplacian W(r) = viscosity_lap * (h - r)
+  float mass;
+} SphKernels;
+
+// Structure-of-arrays copy of the particle state for the solver passes
+typedef struct SphScratch {
+  float *x;
+  float *y;
+  float *vx;
+  float *vy;
+  float *density;
+  float *pressure;
+} SphScratch;
+
+static SphKernels kernels;
+
+const char *physics_model_name(PhysicsModel model) {
+  return model == MODEL_SPH ? "sph" : "rigid";
+}
+
+static void init_kernels() {
+  float h = SPH_SMOOTHING_LENGTH;
+  kernels.h = h;
+  kernels.h_sq = h * h;
+  kernels.poly6 = 4.0f / ((float)M_PI * powf(h, 8.0f));
+  kernels.spiky_grad = 30.0f / ((float)M_PI * powf(h, 5.0f));
+  kernels.viscosity_lap = 40.0f / ((float)M_PI * powf(h, 5.0f));
+  kernels.mass = SPH_SPACING * SPH_SPACING * SPH_REST_DENSITY;
+}
+
+static float *scratch_array(int count) {
+  return frame_alloc(count * sizeof(float));
+}
+
+// The neighbour cells of particle i: the 3x3 block around its own cell
+static void neighbour_cells(const SphScratch *s, int i, int *min_x, int *min_y,
+                            int *max_x, int *max_y) {
+  int cell_x, cell_y;
+  grid_coords(s->x[i], s->y[i], &cell_x, &cell_y);
+  *min_x = cell_x > 0 ? cell_x - 1 : 0;
+  *min_y = cell_y > 0 ? cell_y - 1 : 0;
+  *max_x = cell_x < state.grid_width - 1 ? cell_x + 1 : cell_x;
+  *max_y = cell_y < state.grid_height - 1 ? cell_y + 1 : cell_y;
+}
+
+// Density and pressure of particle i, summed over its grid neighbours
+static void compute_density(SphScratch *s, int i) {
+  int min_x, min_y, max_x, max_y;
+  neighbour_cells(s, i, &min_x, &min_y, &max_x, &max_y);
+
+  float density = 0.0f;
+  for (int y = min_y; y <= max_y; y++) {
+    for (int x = min_x; x <= max_x; x++) {
+      GridCell *cell = &state.grid[y * state.grid_width + x];
+      for (int c = 0; c < cell->count; c++) {
+        int j = cell->particle_indices[c];
+        float dx = s->x[i] - s->x[j];
+        float dy = s->y[i] - s->y[j];
+        float r_sq = dx * dx + dy * dy;
+        if (r_sq < kernels.h_sq) {
+          float diff = kernels.h_sq - r_sq;
+          density += diff * diff * diff;
+        }
+      }
+    }
+  }
+
+  s->density[i] = kernels.mass * kernels.poly6 * density;
+  s->pressure[i] = SPH_STIFFNESS * (s->density[i] - SPH_REST_DENSITY);
+}
+
+// Pressure and viscosity acceleration of particle i, applied to its velocity
+static void apply_forces(const SphScratch *s, int i, float dt) {
+  int min_x, min_y, max_x, max_y;
+  neighbour_cells(s, i, &min_x, &min_y, &max_x, &max_y);
+
+  float ax = 0.0f;
+  float ay = 0.0f;
+  for (int y = min_y; y <= max_y; y++) {
+    for (int x = min_x; x <= max_x; x++) {
+      GridCell *cell = &state.grid[y * state.grid_width + x];
+      for (int c = 0; c < cell->count; c++) {
+        int j = cell->particle_indices[c];
+        if (j == i)
+          continue;
+
+        float dx = s->x[i] - s->x[j];
+        float dy = s->y[i] - s->y[j];
+        float r_sq = dx * dx + dy * dy;
+        if (r_sq >= kernels.h_sq || r_sq <= 0.0f)
+          continue;
+
+        float r = sqrtf(r_sq);
+        float h_r = kernels.h - r;
+        float pressure = kernels.mass * (s->pressure[i] + s->pressure[j]) /
+                         (2.0f * s->density[j]) * kernels.spiky_grad * h_r *
+                         h_r / r;
+        float viscosity = SPH_VISCOSITY * kernels.mass / s->density[j] *
+                          kernels.viscosity_lap * h_r;
+
+        ax += pressure * dx + viscosity * (s->vx[j] - s->vx[i]);
+        ay += pressure * dy + viscosity * (s->vy[j] - s->vy[i]);
+      }
+    }
+  }
+
+  Circle *p = &state.particles[i];
+  p->xvelocity += ax / s->density[i] * dt;
+  p->yvelocity += ay / s->density[i] * dt;
+}
+
+// Replace rigid collisions with SPH pressure and viscosity forces between the
+// neighbours in the current grid. Every pass writes only its own particle's
+// entries, so passes need no locks and do not depend on the thread count.
+void handle_sph_forces() {
+  int count = state.particle_count;
+  if (count == 0)
+    return;
+  if (kernels.h == 0.0f)
+    init_kernels();
+
+  float dt = state.step_dt;
+  SphScratch s = {scratch_array(count), scratch_array(count),
+                  scratch_array(count), scratch_array(count),
+                  scratch_array(count), scratch_array(count)};
+  if (!s.x || !s.y || !s.vx || !s.vy || !s.density || !s.pressure)
+    return;
+
+#pragma omp parallel
+  {
+#pragma omp for schedule(static, PARTICLE_CHUNK)
+    for (int i = 0; i < count; i++) {
+      Circle *p = &state.particles[i];
+      s.x[i] = p->xcenter;
+      s.y[i] = p->ycenter;
+      s.vx[i] = p->xvelocity;
+      s.vy[i] = p->yvelocity;
+    }
+
+#pragma omp for schedule(static, PARTICLE_CHUNK)
+    for (int i = 0; i < count; i++) {
+      compute_density(&s, i);
+    }
+
+#pragma omp for schedule(static, PARTICLE_CHUNK)
+    for (int i = 0; i < count; i++) {
+      apply_forces(&s, i, dt);
+    }
+  }
+}
@@ -0,0 +1,9 @@
+#ifndef SPH_H
+#define SPH_H
+
+#include "defs.h"
+
+void handle_sph_forces();
+const char *physics_model_name(PhysicsModel model);
+
+#endif
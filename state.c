@@ -1,12 +1,80 @@
 #include "allocator.h"
+#include "balance.h"
+#include "barnes_hut.h"
+#include "brush.h"
+#include "ccd.h"
+#include "constraints.h"
 #include "defs.h"
+#include "governor.h"
+#include "neighbour.h"
+#include "obstacle.h"
+#include "sph.h"
 #include "physics.h"
+#include "publish.h"
+#include "scenario.h"
+#include "state.h"
+#include "sweep.h"
+#include "trace.h"
 #include "util.h"
 #include <SDL2/SDL_timer.h>
+#include <math.h>
 #include <omp.h>
+#include <string.h>
 
 extern State state;
 
+// Current time in milliseconds on the simulation clock: wall-clock ticks
+// normally, accumulated fixed steps in fixed-dt mode
+Uint32 simulation_ticks() {
+  if (state.settings.fixed_dt > 0.0f) {
+    return (Uint32)(state.sim_time * 1000.0f);
+  }
+  return SDL_GetTicks();
+}
+
+const char *broad_phase_name(BroadPhase broad_phase) {
+  switch (broad_phase) {
+  case BROAD_PHASE_NEIGHBOUR_LIST:
+    return "lists";
+  case BROAD_PHASE_SWEEP:
+    return "sweep";
+  default:
+    return "grid";
+  }
+}
+
+void set_deterministic(int enabled) {
+  state.settings.deterministic = enabled;
+  state.settings.fixed_dt = enabled ? DETERMINISTIC_DT : 0.0f;
+}
+
+// Restamp all particles so the next wall-clock step does not see the time
+// that passed while the simulation was paused or stepped manually
+void reset_particle_timestamps() {
+  Uint32 current_time = SDL_GetTicks();
+  for (int i = 0; i < state.particle_count; i++) {
+    state.particles[i].lastupdated = current_time;
+  }
+}
+
+// 64-bit FNV-1a over the position and velocity bits of every particle
+uint64_t hash_state() {
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = 0; i < state.particle_count; i++) {
+    Circle *p = &state.particles[i];
+    float fields[4] = {p->xcenter, p->ycenter, p->xvelocity, p->yvelocity};
+    for (int f = 0; f < 4; f++) {
+      uint32_t bits;
+      memcpy(&bits, &fields[f], sizeof(bits));
+      hash ^= bits;
+      hash *= 1099511628211ULL;
+    }
+  }
+  hash ^= (uint64_t)state.particle_count;
+  hash *= 1099511628211ULL;
+  return hash;
+}
+
 // Function to add a particle to the array
 void add_particle(Circle c) {
   int index = allocator_alloc_particle();
@@ -17,74 +85,352 @@ void add_particle(Circle c) {
 
   state.particles[index] = c;
   state.particle_count++;
+  state.grid_current = 0;
+  if (!is_uniform_particle(&c))
+    state.uniform_particles = 0;
+}
+
+// Remove a particle by moving the last one into its slot, which keeps the
+// particle array dense and hands the last pool slot back to the allocator
+void remove_particle(int index) {
+  int last = state.particle_count - 1;
+  if (index < 0 || index > last) {
+    printf("Invalid particle index in remove_particle\n");
+    return;
+  }
+
+  if (index != last) {
+    state.particles[index] = state.particles[last];
+  }
+  allocator_free_particle(last);
+  state.particle_count--;
+  state.grid_current = 0;
+  invalidate_neighbour_lists();
 }
 
 void reset_state() {
   allocator_reset();
   state.particle_count = 0;
+  state.next_particle_id = 0;
+  clear_constraints();
+  state.uniform_particles = 1;
+  state.grid_current = 0;
+  invalidate_neighbour_lists();
+  invalidate_sweep_order();
+}
+
+// Allocate the spatial grid for a world of the given size in pixels. The grid
+// is first touched with the same static schedule as the collision phase.
+int init_world(int width, int height) {
+  cleanup_world();
+
+  state.world_width = width;
+  state.world_height = height;
+  state.grid_width = (width + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE;
+  state.grid_height = (height + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE;
+
+  int cells = state.grid_width * state.grid_height;
+  state.grid = allocator_alloc_buffer(cells * sizeof(GridCell));
+  if (!state.grid) {
+    printf("Failed to allocate spatial grid\n");
+    return -1;
+  }
+  allocator_first_touch(state.grid, sizeof(GridCell), cells, 0);
+
+  return 0;
+}
+
+void cleanup_world() {
+  if (state.grid) {
+    allocator_free_buffer(state.grid);
+    state.grid = NULL;
+  }
+  clear_obstacles();
+  state.grid_width = 0;
+  state.grid_height = 0;
+  state.grid_current = 0;
+}
+
+// Reserve count consecutive particle slots and return the first index. The
+// caller fills them, typically in a parallel loop, gives them the ids from
+// state.next_particle_id on, and clears state.uniform_particles if any of
+// them differs from the defaults.
+int add_particles(int count) {
+  int first = state.particle_count;
+  for (int i = 0; i < count; i++) {
+    if (allocator_alloc_particle() < 0) {
+      printf("Memory allocation failed\n");
+      exit(1);
+    }
+  }
+  state.particle_count += count;
+  state.next_particle_id += count;
+  state.grid_current = 0;
+  return first;
+}
+
+// Cell containing a point, clamped to the grid bounds
+void grid_coords(float x, float y, int *grid_x, int *grid_y) {
+  *grid_x = (int)(x / GRID_CELL_SIZE);
+  *grid_y = (int)(y / GRID_CELL_SIZE);
+
+  if (*grid_x < 0)
+    *grid_x = 0;
+  if (*grid_x >= state.grid_width)
+    *grid_x = state.grid_width - 1;
+  if (*grid_y < 0)
+    *grid_y = 0;
+  if (*grid_y >= state.grid_height)
+    *grid_y = state.grid_height - 1;
 }
 
 void clear_grid() {
-#pragma omp parallel for collapse(2)
-  for (int y = 0; y < GRID_HEIGHT; y++) {
-    for (int x = 0; x < GRID_WIDTH; x++) {
-      state.grid[y][x].count = 0;
+#pragma omp parallel for collapse(2) schedule(static)
+  for (int y = 0; y < state.grid_height; y++) {
+    for (int x = 0; x < state.grid_width; x++) {
+      GridCell *cell = &state.grid[y * state.grid_width + x];
+      cell->count = 0;
+      cell->velocity_x_sum = 0.0f;
+      cell->velocity_y_sum = 0.0f;
     }
   }
 }
 
 void assign_particles_to_grid() {
   clear_grid();
+  state.grid_current = 1;
+  state.diagnostics.grid_overflow = 0;
 
   for (int i = 0; i < state.particle_count; i++) {
     Circle *p = &state.particles[i];
-    int grid_x = (int)(p->xcenter / GRID_CELL_SIZE);
-    int grid_y = (int)(p->ycenter / GRID_CELL_SIZE);
-
-    // Clamp to grid bounds
-    if (grid_x < 0)
-      grid_x = 0;
-    if (grid_x >= GRID_WIDTH)
-      grid_x = GRID_WIDTH - 1;
-    if (grid_y < 0)
-      grid_y = 0;
-    if (grid_y >= GRID_HEIGHT)
-      grid_y = GRID_HEIGHT - 1;
-
-    GridCell *cell = &state.grid[grid_y][grid_x];
+    int grid_x, grid_y;
+    grid_coords(p->xcenter, p->ycenter, &grid_x, &grid_y);
+
+    GridCell *cell = &state.grid[grid_y * state.grid_width + grid_x];
     if (cell->count < MAX_PARTICLES_PER_CELL) {
       cell->particle_indices[cell->count] = i;
       cell->count++;
+      cell->velocity_x_sum += p->xvelocity;
+      cell->velocity_y_sum += p->yvelocity;
+    } else {
+      state.diagnostics.grid_overflow++;
     }
   }
 }
 
+// Step length for the solvers that work on the whole step: the fixed step,
+// or the wall-clock time since the last step capped at FORCE_MAX_DT
+static void advance_step_clock() {
+  Uint32 now = SDL_GetTicks();
+  float dt = state.settings.fixed_dt;
+  if (dt <= 0.0f) {
+    dt = state.last_step_ticks ? (now - state.last_step_ticks) / 1000.0f
+                               : FORCE_MAX_DT;
+    if (dt > FORCE_MAX_DT)
+      dt = FORCE_MAX_DT;
+  }
+  state.last_step_ticks = now;
+  state.step_dt = dt;
+}
+
 void update_state() {
+  double phase_start = omp_get_wtime();
+  advance_step_clock();
+
+  // Transient buffers from the previous step are released in one go
+  frame_arena_reset();
+
+  int use_lists = state.settings.broad_phase == BROAD_PHASE_NEIGHBOUR_LIST;
+  int use_sweep = state.settings.broad_phase == BROAD_PHASE_SWEEP;
+  int use_sph = state.settings.model == MODEL_SPH;
+  int diagnose = state.settings.diagnostics;
+  float max_displacement_sq = 0.0f;
+  float max_penetration = 0.0f;
+  double kinetic = 0.0, potential = 0.0;
+  double momentum_x = 0.0, momentum_y = 0.0;
+  FastParticle *fast = frame_alloc(state.particle_count * sizeof(FastParticle));
+  int fast_count = 0;
+
+  // Constants are folded into the kernels while every particle is uniform
+  select_collision_kernels(state.uniform_particles);
+
+  // Particles under the mouse brush, found through the grid before it goes
+  // out of date
+  int *brushed = NULL;
+  float brush_dt = 0.0f;
+  int brushed_count = collect_brushed_particles(&brushed, &brush_dt);
+  state.grid_current = 0;
+
+  // Gravity or electrostatics between all particles, from the Barnes-Hut tree
+  // over the positions at the start of the step
+  apply_long_range_forces();
+
+  // External readers get the integrated positions straight from this loop
+  int published_count;
+  ShmParticle *published = begin_publish(&published_count);
+
+#pragma omp parallel
+  {
+    // Brush forces first, each brushed particle is listed once
+#pragma omp for
+    for (int b = 0; b < brushed_count; b++) {
+      apply_brush(&state.particles[brushed[b]], brush_dt);
+    }
+
 // Phase 1: Parallel position updates (no race conditions)
-#pragma omp parallel for
-  for (int i = 0; i < state.particle_count; i++) {
-    calculate_location(&state.particles[i]);
-    handle_border_collisions(&state.particles[i]);
+#pragma omp for schedule(static, PARTICLE_CHUNK) \
+    reduction(max : max_displacement_sq) \
+    reduction(+ : kinetic, potential, momentum_x, momentum_y)
+    for (int i = 0; i < state.particle_count; i++) {
+      Circle *p = &state.particles[i];
+      float start_x = p->xcenter;
+      float start_y = p->ycenter;
+      calculate_location(p);
+
+      // Only the few particles that moved far take the swept path
+      if (fast && is_fast_step(p, start_x, start_y)) {
+        handle_swept_border_collisions(p);
+        handle_swept_obstacle_collisions(p, start_x, start_y);
+        int slot;
+#pragma omp atomic capture
+        slot = fast_count++;
+        fast[slot] = (FastParticle){i, start_x, start_y};
+      } else {
+        handle_border_collisions(p);
+        handle_obstacle_collisions(p);
+      }
+      if (i < published_count)
+        publish_particle(&published[i], p);
+
+      float displacement_sq = p->dx * p->dx + p->dy * p->dy;
+      if (displacement_sq > max_displacement_sq)
+        max_displacement_sq = displacement_sq;
+
+      if (diagnose) {
+        float speed_sq =
+            p->xvelocity * p->xvelocity + p->yvelocity * p->yvelocity;
+        float height = state.world_height - (p->ycenter + p->radius);
+        kinetic += 0.5 * p->m * speed_sq;
+        potential += (double)p->m * GRAVITY * height;
+        momentum_x += (double)p->m * p->xvelocity;
+        momentum_y += (double)p->m * p->yvelocity;
+      }
+    }
   }
+  end_publish();
+
+  double grid_start = omp_get_wtime();
 
-  // Phase 2: Update spatial grid
-  assign_particles_to_grid();
+  // Phase 2: Update the broad phase (the grid only when lists are stale).
+  // The fluid model always works on the grid.
+  int rebuild_lists = !use_sph && use_lists &&
+                      neighbour_lists_stale(max_displacement_sq);
+  if (use_sph || (!use_sweep && !use_lists) || rebuild_lists ||
+      fast_count > 0) {
+    assign_particles_to_grid();
+  }
+
+  // Fast particles are swept against their neighbours on that grid before
+  // the sweep order or the lists see their end positions
+  if (fast_count > 0) {
+    handle_fast_particles(fast, fast_count);
+  }
 
-// Phase 3: Spatial grid-based collision detection
-#pragma omp parallel for collapse(2)
-  for (int y = 0; y < GRID_HEIGHT; y++) {
-    for (int x = 0; x < GRID_WIDTH; x++) {
-      handle_grid_cell_collisions(x, y);
+  if (use_sweep && !use_sph) {
+    update_sweep_order();
+  } else if (rebuild_lists) {
+    build_neighbour_lists();
+  }
+
+  // The heat map is drawn from the grid, which these broad phases may skip
+  if (state.settings.render_mode != RENDER_PARTICLES && !state.grid_current) {
+    assign_particles_to_grid();
+  }
+
+  double collide_start = omp_get_wtime();
+
+  // Phase 3: Collision detection over the broad phase candidates, or fluid
+  // forces between grid neighbours
+  if (use_sph) {
+    handle_sph_forces();
+  } else if (use_sweep) {
+    max_penetration = handle_sweep_collisions();
+  } else if (use_lists) {
+    max_penetration = handle_neighbour_collisions();
+  } else if (state.settings.deterministic) {
+    // A cell only touches itself and its right and lower neighbours, so cells
+    // two apart in both directions never share particles. Sweeping the four
+    // colours of that 2x2 pattern one after another keeps every pass race-free
+    // and the result independent of the thread count.
+    for (int pass = 0; pass < 4; pass++) {
+      int y0 = pass / 2;
+      int x0 = pass % 2;
+#pragma omp parallel for collapse(2) reduction(max : max_penetration)
+      for (int y = y0; y < state.grid_height; y += 2) {
+        for (int x = x0; x < state.grid_width; x += 2) {
+          max_penetration =
+              fmaxf(max_penetration, handle_grid_cell_collisions(x, y));
+        }
+      }
     }
+  } else if (state.settings.collision_schedule == SCHEDULE_STATIC) {
+    max_penetration = handle_grid_collisions_static();
+  } else {
+    max_penetration = handle_grid_collisions_balanced();
+  }
+
+  // Contacts in a pile can push particles into a thin obstacle, so they are
+  // projected out again before the next step reads the distance field
+  if (state.obstacles.distance) {
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+    for (int i = 0; i < state.particle_count; i++) {
+      handle_obstacle_collisions(&state.particles[i]);
+    }
+  }
+
+  double constraint_start = omp_get_wtime();
+
+  // Phase 4: Springs between particle ids, relaxed one colour at a time
+  solve_constraints();
+
+  double phase_end = omp_get_wtime();
+  state.timings.integrate_ms = (grid_start - phase_start) * 1000.0;
+  state.timings.grid_ms = (collide_start - grid_start) * 1000.0;
+  state.timings.collide_ms = (constraint_start - collide_start) * 1000.0;
+  state.timings.constraint_ms = (phase_end - constraint_start) * 1000.0;
+
+  if (diagnose) {
+    state.diagnostics.kinetic_energy = kinetic;
+    state.diagnostics.potential_energy = potential;
+    state.diagnostics.momentum_x = momentum_x;
+    state.diagnostics.momentum_y = momentum_y;
+    state.diagnostics.max_penetration = max_penetration;
+  }
+
+  if (state.settings.fixed_dt > 0.0f) {
+    state.sim_time += state.settings.fixed_dt;
   }
+  if (state.settings.deterministic) {
+    state.state_hash = hash_state();
+  }
+  write_trace_row();
 }
 
 void init_state() {
   state.particles = allocator_get_pool();
   state.particle_count = 0;
+  state.next_particle_id = 0;
+  state.uniform_particles = 1;
   state.fps = 0.0f;
   state.last_fps_update = SDL_GetTicks();
   state.frame_count = 0;
+  state.sim_time = 0.0f;
+  state.state_hash = 0;
+
+  // Deterministic runs restart the RNG on every reset so they replay exactly
+  if (state.settings.deterministic) {
+    seed_random(state.settings.seed);
+  }
 
   // Initialize settings
   state.settings.gravity = GRAVITY;
@@ -94,6 +440,7 @@ void init_state() {
   state.settings.show_settings = 1;
   state.settings.is_paused = 0;
   state.settings.show_velocity_vectors = 0;
+  reset_governor();
 
   // Initialize particle source using constants
   state.source.x = SOURCE_X;
@@ -102,10 +449,14 @@ void init_state() {
   state.source.height = SOURCE_SIZE;
   state.source.flow_rate = SOURCE_FLOW_RATE;
   state.source.velocity_magnitude = SOURCE_VELOCITY_MAGNITUDE;
-  state.source.last_spawn_time = SDL_GetTicks();
+  state.source.last_spawn_time = simulation_ticks();
   state.source.is_active = 1;
   state.source.particles_spawned = 0;
+  state.source.max_particles = MAX_SOURCE_PARTICLES;
   state.source.emitter_side = EMITTER_RIGHT;
+
+  // A loaded scenario replaces the default emitter and places its particles
+  apply_scenario();
 }
 
 void update_particle_source() {
@@ -113,17 +464,18 @@ void update_particle_source() {
     return;
 
   // Stop generating if we've reached the maximum source particles
-  if (state.source.particles_spawned >= MAX_SOURCE_PARTICLES) {
+  if (state.source.particles_spawned >= state.source.max_particles) {
     state.source.is_active = 0; // Deactivate source when limit reached
     return;
   }
 
-  Uint32 current_time = SDL_GetTicks();
+  Uint32 current_time = simulation_ticks();
   float dt = (current_time - state.source.last_spawn_time) / 1000.0f;
-  float spawn_interval = 1.0f / state.source.flow_rate;
+  float spawn_interval =
+      governor_spawn_interval_scale() / state.source.flow_rate;
 
   // Check if it's time to spawn a new particle
-  if (dt >= spawn_interval && state.particle_count < MAX_SOURCE_PARTICLES) {
+  if (dt >= spawn_interval && allocator_free_slots() > 0) {
     float spawn_x, spawn_y;
     float velocity_x, velocity_y;
 
@@ -172,13 +524,14 @@ void update_particle_source() {
                            .radius = PARTICLE_RADIUS,
                            .xvelocity = velocity_x,
                            .yvelocity = velocity_y,
-                           .m = 20.0f,
-                           .cor = 0.80f,
+                           .m = PARTICLE_MASS,
+                           .cor = PARTICLE_COR,
+                           .charge = state.particle_count % 2 ? 1.0f : -1.0f,
                            .dx = 0.0f,
                            .dy = 0.0f,
                            .color = USE_RANDOM_COLORS ? generate_random_color()
                                                       : Color_CIRCLE,
-                           .id = state.particle_count,
+                           .id = state.next_particle_id++,
                            .lastupdated = current_time};
 
     add_particle(new_particle);
@@ -1,10 +1,23 @@
 #ifndef STATE_H
 #define STATE_H
 
+#include "defs.h"
+
+Uint32 simulation_ticks();
 void init_state();
+int init_world(int width, int height);
+void cleanup_world();
+void grid_coords(float x, float y, int *grid_x, int *grid_y);
+void assign_particles_to_grid();
+void add_particle(Circle c);
+int add_particles(int count);
+void remove_particle(int index);
 void update_state();
 void reset_state();
 void update_fps();
 void update_particle_source();
+void set_deterministic(int enabled);
+const char *broad_phase_name(BroadPhase broad_phase);
+void reset_particle_timestamps();
 
 #endif
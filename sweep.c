@@ -0,0 +1,152 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+#include "defs.h"
+#include "physics.h"
+#include "sweep.h"
+
+extern State state;
+
+// Particles sorted by the left edge of their x interval. The order is kept
+// between steps, so re-sorting after small moves is a nearly linear insertion
+// sort. The entries are always a permutation of particle indices, so removals
+// need no notification: entries past the new particle count are dropped, and
+// the particle moved into a freed slot is sorted back into place.
+typedef struct SweepEntry {
+  float min_x;
+  float max_x;
+  int index;
+} SweepEntry;
+
+static SweepEntry *entries;
+static int entries_capacity;
+static int sorted_count; // particles present in entries
+static int rebuild = 1;  // order lost, sort from scratch
+
+void invalidate_sweep_order() {
+  sorted_count = 0;
+  rebuild = 1;
+}
+
+static int compare_entries(const void *a, const void *b) {
+  const SweepEntry *ea = a;
+  const SweepEntry *eb = b;
+  if (ea->min_x != eb->min_x)
+    return ea->min_x < eb->min_x ? -1 : 1;
+  return ea->index - eb->index;
+}
+
+static void grow_entries(int needed) {
+  if (needed <= entries_capacity)
+    return;
+
+  int new_capacity = needed + needed / 2;
+  SweepEntry *grown = allocator_alloc_buffer(new_capacity * sizeof(SweepEntry));
+  if (!grown) {
+    printf("Failed to allocate sweep-and-prune entries\n");
+    exit(1);
+  }
+  for (int i = 0; i < sorted_count; i++) {
+    grown[i] = entries[i];
+  }
+  allocator_free_buffer(entries);
+  entries = grown;
+  entries_capacity = new_capacity;
+}
+
+// Refresh the intervals from the current positions and restore the order.
+// Particles added since the last step are appended and sorted in.
+void update_sweep_order() {
+  int n = state.particle_count;
+  grow_entries(n);
+
+  if (sorted_count > n) {
+    int kept = 0;
+    for (int k = 0; k < sorted_count; k++) {
+      if (entries[k].index < n)
+        entries[kept++] = entries[k];
+    }
+    sorted_count = kept;
+  }
+  // Many new particles at once are cheaper to sort from scratch
+  if (n - sorted_count > sorted_count)
+    rebuild = 1;
+  for (int i = sorted_count; i < n; i++) {
+    entries[i].index = i;
+  }
+  sorted_count = n;
+
+#pragma omp parallel for schedule(static, PARTICLE_CHUNK)
+  for (int k = 0; k < n; k++) {
+    Circle *p = &state.particles[entries[k].index];
+    entries[k].min_x = p->xcenter - p->radius;
+    entries[k].max_x = p->xcenter + p->radius;
+  }
+
+  if (rebuild) {
+    qsort(entries, n, sizeof(SweepEntry), compare_entries);
+    rebuild = 0;
+    return;
+  }
+
+  for (int k = 1; k < n; k++) {
+    SweepEntry entry = entries[k];
+    int j = k - 1;
+    while (j >= 0 && entries[j].min_x > entry.min_x) {
+      entries[j + 1] = entries[j];
+      j--;
+    }
+    entries[j + 1] = entry;
+  }
+}
+
+// Test one particle against every later particle whose interval starts
+// before its own ends
+static inline float sweep_pairs(int k, PairCollisionFn pair) {
+  SweepEntry *a = &entries[k];
+  Circle *p1 = &state.particles[a->index];
+  float deepest = 0.0f;
+
+  for (int j = k + 1; j < sorted_count && entries[j].min_x <= a->max_x; j++) {
+    Circle *p2 = &state.particles[entries[j].index];
+    float reach = p1->radius + p2->radius;
+    float dy = p1->ycenter - p2->ycenter;
+    if (dy <= reach && dy >= -reach) {
+      deepest = fmaxf(deepest, pair(p1, p2));
+    }
+  }
+  return deepest;
+}
+
+// The kernel is chosen once per particle, so the pair loop calls it directly
+static float sweep_from(int k, int uniform) {
+  return uniform ? sweep_pairs(k, handle_pair_collision_uniform)
+                 : sweep_pairs(k, handle_pair_collision_generic);
+}
+
+float handle_sweep_collisions() {
+  int uniform = handle_pair_collision == handle_pair_collision_uniform;
+  float deepest = 0.0f;
+  if (state.settings.deterministic) {
+    for (int k = 0; k < sorted_count; k++) {
+      deepest = fmaxf(deepest, sweep_from(k, uniform));
+    }
+  } else {
+    // Run lengths vary with the local density along x
+#pragma omp parallel for schedule(dynamic, 256) reduction(max : deepest)
+    for (int k = 0; k < sorted_count; k++) {
+      deepest = fmaxf(deepest, sweep_from(k, uniform));
+    }
+  }
+  return deepest;
+}
+
+void cleanup_sweep() {
+  allocator_free_buffer(entries);
+  entries = NULL;
+  entries_capacity = 0;
+  sorted_count = 0;
+  rebuild = 1;
+}
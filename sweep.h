@@ -0,0 +1,9 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+void update_sweep_order();
+float handle_sweep_collisions();
+void invalidate_sweep_order();
+void cleanup_sweep();
+
+#endif
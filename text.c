@@ -0,0 +1,163 @@
+#include <SDL2/SDL.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "defs.h"
+#include "text.h"
+
+extern State state;
+
+#define FIRST_GLYPH 32 // printable ASCII only
+#define LAST_GLYPH 126
+#define GLYPH_COUNT (LAST_GLYPH - FIRST_GLYPH + 1)
+#define ATLAS_COLUMNS 16
+#define TEXT_MAX_GLYPHS 4096 // glyphs per frame
+#define TEXT_MAX_LINE 256
+
+typedef struct Glyph {
+  float u0, v0, u1, v1;
+  int width;   // of the rendered glyph, in pixels
+  int advance; // pen movement to the next glyph
+} Glyph;
+
+static Glyph glyphs[GLYPH_COUNT];
+static int glyph_height;
+static SDL_Vertex *text_vertices;
+static int *text_indices;
+static int text_glyph_count;
+
+// Render every printable glyph of state.font once into a grid on an in-memory
+// surface and upload it as a single texture
+int init_text() {
+  SDL_Color white = {255, 255, 255, 255};
+  SDL_Surface *rendered[GLYPH_COUNT];
+  int cell_width = 0;
+
+  glyph_height = TTF_FontHeight(state.font);
+  for (int g = 0; g < GLYPH_COUNT; g++) {
+    rendered[g] = TTF_RenderGlyph_Blended(state.font, FIRST_GLYPH + g, white);
+    if (rendered[g] && rendered[g]->w > cell_width)
+      cell_width = rendered[g]->w;
+  }
+
+  int rows = (GLYPH_COUNT + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS;
+  int width = cell_width * ATLAS_COLUMNS;
+  int height = glyph_height * rows;
+  SDL_Surface *atlas = SDL_CreateRGBSurfaceWithFormat(
+      0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+
+  for (int g = 0; g < GLYPH_COUNT; g++) {
+    SDL_Rect cell = {(g % ATLAS_COLUMNS) * cell_width,
+                     (g / ATLAS_COLUMNS) * glyph_height, 0, 0};
+    int advance = 0;
+    TTF_GlyphMetrics(state.font, FIRST_GLYPH + g, NULL, NULL, NULL, NULL,
+                     &advance);
+    glyphs[g] = (Glyph){.advance = advance};
+
+    if (!rendered[g])
+      continue;
+    if (atlas) {
+      // Copy the glyph's alpha as is instead of blending it onto the atlas
+      SDL_SetSurfaceBlendMode(rendered[g], SDL_BLENDMODE_NONE);
+      SDL_BlitSurface(rendered[g], NULL, atlas, &cell);
+      glyphs[g].u0 = (float)cell.x / width;
+      glyphs[g].v0 = (float)cell.y / height;
+      glyphs[g].u1 = (float)(cell.x + rendered[g]->w) / width;
+      glyphs[g].v1 = (float)(cell.y + glyph_height) / height;
+      glyphs[g].width = rendered[g]->w;
+    }
+    SDL_FreeSurface(rendered[g]);
+  }
+
+  if (!atlas) {
+    printf("Failed to create glyph atlas surface\n");
+    return -1;
+  }
+
+  state.glyph_atlas = SDL_CreateTextureFromSurface(state.renderer, atlas);
+  SDL_FreeSurface(atlas);
+  if (!state.glyph_atlas) {
+    printf("Failed to create glyph atlas: %s\n", SDL_GetError());
+    return -1;
+  }
+  SDL_SetTextureBlendMode(state.glyph_atlas, SDL_BLENDMODE_BLEND);
+
+  text_vertices = malloc(TEXT_MAX_GLYPHS * 4 * sizeof(SDL_Vertex));
+  text_indices = malloc(TEXT_MAX_GLYPHS * 6 * sizeof(int));
+  if (!text_vertices || !text_indices) {
+    printf("Failed to allocate text vertices\n");
+    return -1;
+  }
+
+  // The quad layout never changes, only the vertices do
+  for (int g = 0; g < TEXT_MAX_GLYPHS; g++) {
+    int *index = &text_indices[g * 6];
+    index[0] = g * 4 + 0;
+    index[1] = g * 4 + 1;
+    index[2] = g * 4 + 2;
+    index[3] = g * 4 + 1;
+    index[4] = g * 4 + 3;
+    index[5] = g * 4 + 2;
+  }
+  text_glyph_count = 0;
+
+  return 0;
+}
+
+void cleanup_text() {
+  if (state.glyph_atlas) {
+    SDL_DestroyTexture(state.glyph_atlas);
+    state.glyph_atlas = NULL;
+  }
+  free(text_vertices);
+  free(text_indices);
+  text_vertices = NULL;
+  text_indices = NULL;
+}
+
+int text_line_height() { return glyph_height; }
+
+// Queue a line of text with its top-left corner at (x, y). Nothing is drawn
+// until flush_text().
+void draw_text(int x, int y, const char *format, ...) {
+  if (!state.glyph_atlas || !text_vertices)
+    return;
+
+  char line[TEXT_MAX_LINE];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+
+  float pen = x;
+  for (const char *c = line; *c && text_glyph_count < TEXT_MAX_GLYPHS; c++) {
+    if (*c < FIRST_GLYPH || *c > LAST_GLYPH)
+      continue;
+
+    const Glyph *glyph = &glyphs[*c - FIRST_GLYPH];
+    SDL_Vertex *v = &text_vertices[text_glyph_count * 4];
+    SDL_Color white = {255, 255, 255, 255};
+    float right = pen + glyph->width;
+    float bottom = y + glyph_height;
+
+    v[0] = (SDL_Vertex){{pen, y}, white, {glyph->u0, glyph->v0}};
+    v[1] = (SDL_Vertex){{right, y}, white, {glyph->u1, glyph->v0}};
+    v[2] = (SDL_Vertex){{pen, bottom}, white, {glyph->u0, glyph->v1}};
+    v[3] = (SDL_Vertex){{right, bottom}, white, {glyph->u1, glyph->v1}};
+
+    text_glyph_count++;
+    pen += glyph->advance;
+  }
+}
+
+// Draw all queued text in one call
+void flush_text() {
+  if (text_glyph_count == 0)
+    return;
+
+  SDL_RenderGeometry(state.renderer, state.glyph_atlas, text_vertices,
+                     text_glyph_count * 4, text_indices,
+                     text_glyph_count * 6);
+  text_glyph_count = 0;
+}
@@ -0,0 +1,10 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+int init_text();
+void cleanup_text();
+int text_line_height();
+void draw_text(int x, int y, const char *format, ...);
+void flush_text();
+
+#endif
@@ -0,0 +1,133 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shm_reader.h"
+
+#define READ_RETRIES 16
+
+// The layout is copied at open, once it has been checked against the size of
+// the mapping, so a writer cannot move the slots afterwards
+struct ShmReader {
+  const ShmHeader *header;
+  size_t size;
+  uint64_t last_frame;
+  uint32_t slots;
+  uint32_t capacity;
+  uint64_t slot_bytes;
+  uint64_t data_offset;
+};
+
+ShmReader *shm_reader_open(const char *name) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    printf("Failed to open shared memory %s, is the simulation publishing?\n",
+           name);
+    return NULL;
+  }
+  struct stat info;
+  if (fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(ShmHeader)) {
+    printf("Shared memory %s is too small\n", name);
+    close(fd);
+    return NULL;
+  }
+  void *memory = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    printf("Failed to map shared memory %s\n", name);
+    return NULL;
+  }
+
+  const ShmHeader *header = memory;
+  if (header->magic != SHM_MAGIC || header->version != SHM_VERSION) {
+    printf("Shared memory %s is not a version %d particle ring\n", name,
+           SHM_VERSION);
+    munmap(memory, info.st_size);
+    return NULL;
+  }
+  atomic_thread_fence(memory_order_acquire);
+
+  // Every slot the header describes must lie inside the mapping
+  uint32_t slots = header->slots;
+  uint32_t capacity = header->capacity;
+  uint64_t slot_bytes = header->slot_bytes;
+  uint64_t data_offset = header->data_offset;
+  uint64_t size = info.st_size;
+  if (slots == 0 ||
+      slot_bytes < sizeof(ShmSlot) + (uint64_t)capacity * sizeof(ShmParticle) ||
+      data_offset < sizeof(ShmHeader) || data_offset > size ||
+      slot_bytes > (size - data_offset) / slots) {
+    printf("Shared memory %s has an inconsistent layout\n", name);
+    munmap(memory, info.st_size);
+    return NULL;
+  }
+
+  ShmReader *reader = malloc(sizeof(ShmReader));
+  if (!reader) {
+    munmap(memory, info.st_size);
+    return NULL;
+  }
+  *reader = (ShmReader){.header = header,
+                        .size = info.st_size,
+                        .slots = slots,
+                        .capacity = capacity,
+                        .slot_bytes = slot_bytes,
+                        .data_offset = data_offset};
+  return reader;
+}
+
+void shm_reader_close(ShmReader *reader) {
+  if (!reader)
+    return;
+  munmap((void *)reader->header, reader->size);
+  free(reader);
+}
+
+const ShmHeader *shm_reader_header(const ShmReader *reader) {
+  return reader->header;
+}
+
+int shm_reader_read(ShmReader *reader, ShmParticle *out, int max,
+                    ShmFrameInfo *info) {
+  const ShmHeader *header = reader->header;
+
+  for (int attempt = 0; attempt < READ_RETRIES; attempt++) {
+    uint64_t latest = atomic_load_explicit(
+        (_Atomic uint64_t *)&header->latest, memory_order_acquire);
+    if (latest == reader->last_frame)
+      return 0;
+
+    const ShmSlot *slot =
+        (const ShmSlot *)((const char *)header + reader->data_offset +
+                          (latest % reader->slots) * reader->slot_bytes);
+    uint32_t before = atomic_load_explicit(
+        (_Atomic uint32_t *)&slot->sequence, memory_order_acquire);
+    if (before & 1)
+      continue;
+
+    uint64_t frame = slot->frame;
+    double time = slot->time;
+    uint32_t count = slot->count;
+    if (count > reader->capacity)
+      continue; // torn or corrupt, never read past the slot
+    int copied = count < (uint32_t)max ? (int)count : max;
+    memcpy(out, slot->particles, copied * sizeof(ShmParticle));
+
+    // A changed sequence means the writer lapped the ring during the copy
+    atomic_thread_fence(memory_order_acquire);
+    uint32_t after = atomic_load_explicit((_Atomic uint32_t *)&slot->sequence,
+                                          memory_order_relaxed);
+    if (after != before || frame != latest)
+      continue;
+
+    reader->last_frame = latest;
+    if (info)
+      *info = (ShmFrameInfo){frame, time, count};
+    return copied;
+  }
+  return -1;
+}
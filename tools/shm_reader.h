@@ -0,0 +1,28 @@
+#ifndef SHM_READER_H
+#define SHM_READER_H
+
+#include "shm_layout.h"
+
+// Attach to the particle ring published by `sdl_fun --publish`. Any number
+// of readers can attach; they only ever read the mapping, so they cannot
+// slow the simulation down.
+
+typedef struct ShmReader ShmReader;
+
+typedef struct ShmFrameInfo {
+  uint64_t frame;
+  double time;
+  int count; // particles in the frame, may exceed what was copied
+} ShmFrameInfo;
+
+ShmReader *shm_reader_open(const char *name);
+void shm_reader_close(ShmReader *reader);
+const ShmHeader *shm_reader_header(const ShmReader *reader);
+
+// Copy the newest complete frame into out, up to max particles. Returns the
+// number copied, 0 when there is no frame newer than the last one read, or -1
+// when the writer kept overwriting the slot.
+int shm_reader_read(ShmReader *reader, ShmParticle *out, int max,
+                    ShmFrameInfo *info);
+
+#endif
@@ -0,0 +1,59 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "shm_reader.h"
+
+// Example consumer: prints a summary of the published particles about ten
+// times a second. Usage: shm_watch [NAME]
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int signal) {
+  (void)signal;
+  running = 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *name = argc > 1 ? argv[1] : SHM_DEFAULT_NAME;
+  ShmReader *reader = shm_reader_open(name);
+  if (!reader)
+    return -1;
+
+  const ShmHeader *header = shm_reader_header(reader);
+  int capacity = header->capacity;
+  ShmParticle *particles = malloc(capacity * sizeof(ShmParticle));
+  if (!particles) {
+    shm_reader_close(reader);
+    return -1;
+  }
+  printf("Attached to %s: %ux%u world, %d particles per frame\n", name,
+         header->world_width, header->world_height, capacity);
+
+  signal(SIGINT, stop);
+  uint64_t last_frame = 0;
+  while (running) {
+    ShmFrameInfo info;
+    int count = shm_reader_read(reader, particles, capacity, &info);
+    if (count > 0) {
+      double sum_x = 0.0, sum_y = 0.0;
+      for (int i = 0; i < count; i++) {
+        sum_x += particles[i].x;
+        sum_y += particles[i].y;
+      }
+      printf("frame %llu (%llu new) t=%.2fs: %d particles, centre %.1f %.1f\n",
+             (unsigned long long)info.frame,
+             (unsigned long long)(info.frame - last_frame), info.time, count,
+             sum_x / count, sum_y / count);
+      last_frame = info.frame;
+    } else if (count < 0) {
+      printf("frame skipped, the ring was overwritten during the copy\n");
+    }
+    usleep(100000);
+  }
+
+  free(particles);
+  shm_reader_close(reader);
+  return 0;
+}
@@ -0,0 +1,49 @@
+#include <SDL2/SDL_timer.h>
+#include <stdio.h>
+
+#include "defs.h"
+#include "trace.h"
+
+extern State state;
+
+static FILE *trace_file;
+static long trace_step;
+
+// Opening the trace turns the diagnostics on, since its rows are made of them
+int open_trace(const char *path) {
+  trace_file = fopen(path, "w");
+  if (!trace_file) {
+    printf("Failed to open trace file %s\n", path);
+    return -1;
+  }
+  trace_step = 0;
+  state.settings.diagnostics = 1;
+  fprintf(trace_file, "step,time_s,particles,integrate_ms,grid_ms,collide_ms,"
+                      "constraint_ms,kinetic,potential,total,momentum_x,"
+                      "momentum_y,max_penetration,grid_overflow\n");
+  return 0;
+}
+
+void write_trace_row() {
+  if (!trace_file)
+    return;
+
+  const PhaseTimings *t = &state.timings;
+  const Diagnostics *d = &state.diagnostics;
+  // Simulated time in fixed-dt runs, wall-clock time otherwise
+  double time = state.settings.fixed_dt > 0.0f ? state.sim_time
+                                               : SDL_GetTicks() / 1000.0;
+  fprintf(trace_file,
+          "%ld,%.4f,%d,%.3f,%.3f,%.3f,%.3f,%.6g,%.6g,%.6g,%.6g,%.6g,%.4f,%d\n",
+          trace_step++, time, state.particle_count, t->integrate_ms,
+          t->grid_ms, t->collide_ms, t->constraint_ms, d->kinetic_energy,
+          d->potential_energy, d->kinetic_energy + d->potential_energy,
+          d->momentum_x, d->momentum_y, d->max_penetration, d->grid_overflow);
+}
+
+void close_trace() {
+  if (trace_file) {
+    fclose(trace_file);
+    trace_file = NULL;
+  }
+}
@@ -0,0 +1,11 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Per-step metrics trace: one CSV row of phase timings and conservation
+// diagnostics after every update_state()
+
+int open_trace(const char *path);
+void write_trace_row();
+void close_trace();
+
+#endif
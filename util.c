@@ -1,8 +1,31 @@
 #include <stdlib.h>
 #include "util.h"
 
+// xorshift32 state; unlike rand() the sequence is identical on every platform,
+// which deterministic runs rely on
+static uint32_t rng_state = 1;
+
+void seed_random(uint32_t seed) { rng_state = seed ? seed : 1; }
+
+uint32_t next_random() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// Integer hash so parallel fills need no shared RNG state
+uint32_t hash_index(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+
 int rand_int_range(int lower, int upper) {
-  return rand() % (upper + 1 - lower) + lower;
+  return next_random() % (upper + 1 - lower) + lower;
 }
 
 Color generate_random_color() {
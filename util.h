@@ -1,8 +1,13 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stdint.h>
+
 #include "draw.h"
 
+void seed_random(uint32_t seed);
+uint32_t next_random();
+uint32_t hash_index(uint32_t x);
 int rand_int_range(int lower, int upper);
 Color generate_random_color();
 